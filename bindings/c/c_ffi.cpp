@@ -1,58 +1,225 @@
 #include "c_ffi.h"
+#include <algorithm>
+#include <atomic>
 
-extern "C" {
+namespace {
 
-static std::vector<PINE::Shared::BatchCommand> batch_commands;
-static std::vector<int> free_batch_command_indices;
+// Batch commands are kept in a table of slots, shared by every thread and
+// session without locks. A handle is the index of its slot along with the
+// generation of the slot, bumped every time it is freed: stale handles are
+// ignored rather than used on whatever batch command took their slot since.
+// The table grows by chunks which never move, and free slots are kept on a
+// lock-free stack.
 
-PINE::PCSX2 *pine_pcsx2_new() { return new PINE::PCSX2(); }
+constexpr unsigned int index_bits = 20;
+constexpr uint32_t max_slots = 1u << index_bits;
+constexpr uint32_t generation_mask = (1u << (31 - index_bits)) - 1;
+constexpr unsigned int chunk_bits = 10;
+constexpr uint32_t chunk_size = 1u << chunk_bits;
 
-PINE::RPCS3 *pine_rpcs3_new() { return new PINE::RPCS3(); }
+struct Slot {
+    PINE::Shared::BatchCommand batch;
+    // session which finalized the batch command
+    std::atomic<PINE::Shared *> owner = nullptr;
+    // odd while the slot holds a batch command
+    std::atomic<uint32_t> generation = 0;
+    // next free slot on the stack, plus one
+    std::atomic<uint32_t> next = 0;
+};
 
-PINE::DuckStation *pine_duckstation_new() { return new PINE::DuckStation(); }
+std::atomic<Slot *> chunks[max_slots / chunk_size];
 
-void pine_initialize_batch(PINE::Shared *v) { return v->InitializeBatch(); }
+// number of slots ever handed out
+std::atomic<uint32_t> used = 0;
 
-void pine_free_datastream(char *data) { delete[] data; }
+// top free slot plus one in the low half, 0 if there is none; the high half
+// is bumped on every change so a stale top never passes for a current one
+std::atomic<uint64_t> free_slots = 0;
 
-int pine_finalize_batch(PINE::Shared *v) {
-    auto batch = v->FinalizeBatch();
+auto GetSlot(uint32_t index) -> Slot & {
+    Slot *chunk = chunks[index >> chunk_bits].load(std::memory_order_acquire);
+    return chunk[index & (chunk_size - 1)];
+}
 
-    int index;
-    if (!free_batch_command_indices.empty()) {
-        index = free_batch_command_indices.back();
-        free_batch_command_indices.pop_back();
-        batch_commands[index] = std::move(batch);
-    } else {
-        index = static_cast<int>(batch_commands.size());
-        batch_commands.push_back(std::move(batch));
+auto ToHandle(uint32_t index, uint32_t generation) -> int {
+    return (int)(((generation >> 1) & generation_mask) << index_bits | index);
+}
+
+// returns the slot a live handle refers to, nullptr if there is none
+auto FindSlot(int cmd, uint32_t &generation) -> Slot * {
+    if (cmd < 0)
+        return nullptr;
+    uint32_t index = cmd & (max_slots - 1);
+    Slot *chunk = chunks[index >> chunk_bits].load(std::memory_order_acquire);
+    if (!chunk)
+        return nullptr;
+    Slot &slot = chunk[index & (chunk_size - 1)];
+    generation = slot.generation.load(std::memory_order_acquire);
+    if (generation % 2 == 0 || ToHandle(index, generation) != cmd)
+        return nullptr;
+    return &slot;
+}
+
+auto FindBatch(int cmd) -> PINE::Shared::BatchCommand * {
+    uint32_t generation;
+    Slot *slot = FindSlot(cmd, generation);
+    return slot ? &slot->batch : nullptr;
+}
+
+// takes a free slot, or a new one, returning max_slots if the table is full
+auto AcquireSlot() -> uint32_t {
+    uint64_t head = free_slots.load(std::memory_order_acquire);
+    while (uint32_t top = (uint32_t)head) {
+        uint32_t next = GetSlot(top - 1).next.load(std::memory_order_relaxed);
+        if (free_slots.compare_exchange_weak(
+                head, ((head >> 32) + 1) << 32 | next,
+                std::memory_order_acquire, std::memory_order_acquire))
+            return top - 1;
     }
 
+    uint32_t index = used.load(std::memory_order_relaxed);
+    do {
+        if (index == max_slots)
+            return max_slots;
+    } while (!used.compare_exchange_weak(index, index + 1,
+                                         std::memory_order_relaxed));
+    std::atomic<Slot *> &chunk = chunks[index >> chunk_bits];
+    if (!chunk.load(std::memory_order_acquire)) {
+        Slot *fresh = new Slot[chunk_size];
+        Slot *expected = nullptr;
+        if (!chunk.compare_exchange_strong(expected, fresh,
+                                           std::memory_order_acq_rel))
+            delete[] fresh;
+    }
     return index;
 }
 
-uint64_t pine_get_reply_int(PINE::Shared *v, int cmd, int place,
-                            PINE::Shared::IPCCommand msg) {
-    PINE::Shared::BatchCommand &command = batch_commands[cmd];
+// puts a slot back on the free stack
+auto ReleaseSlot(uint32_t index) -> void {
+    Slot &slot = GetSlot(index);
+    uint64_t head = free_slots.load(std::memory_order_relaxed);
+    do {
+        slot.next.store((uint32_t)head, std::memory_order_relaxed);
+    } while (!free_slots.compare_exchange_weak(
+        head, ((head >> 32) + 1) << 32 | (index + 1),
+        std::memory_order_release, std::memory_order_relaxed));
+}
+
+// frees every batch command a session finalized
+auto FreeBatchCommands(PINE::Shared *v) -> void {
+    for (uint32_t index = 0; index < used.load(std::memory_order_acquire);
+         index++) {
+        if (!chunks[index >> chunk_bits].load(std::memory_order_acquire))
+            continue;
+        Slot &slot = GetSlot(index);
+        uint32_t generation = slot.generation.load(std::memory_order_acquire);
+        if (generation % 2 == 1 &&
+            slot.owner.load(std::memory_order_relaxed) == v)
+            pine_free_batch_command(ToHandle(index, generation));
+    }
+}
+
+// decodes an integer reply of a batch command, 0 if it is not one
+auto GetReplyInt(PINE::Shared *v, PINE::Shared::BatchCommand &command,
+                 int place, PINE::Shared::IPCCommand msg) -> uint64_t {
     switch (msg) {
         case PINE::Shared::MsgRead8:
+        case PINE::Shared::MsgModify8:
             return (uint64_t)v->GetReply<PINE::Shared::MsgRead8>(command,
                                                                  place);
         case PINE::Shared::MsgRead16:
+        case PINE::Shared::MsgModify16:
             return (uint64_t)v->GetReply<PINE::Shared::MsgRead16>(command,
                                                                   place);
         case PINE::Shared::MsgRead32:
+        case PINE::Shared::MsgModify32:
             return (uint64_t)v->GetReply<PINE::Shared::MsgRead32>(command,
                                                                   place);
         case PINE::Shared::MsgRead64:
+        case PINE::Shared::MsgModify64:
             return v->GetReply<PINE::Shared::MsgRead64>(command, place);
         default:
             return 0;
     }
 }
 
+} // namespace
+
+extern "C" {
+
+PINE::PCSX2 *pine_pcsx2_new() { return new PINE::PCSX2(); }
+
+PINE::RPCS3 *pine_rpcs3_new() { return new PINE::RPCS3(); }
+
+PINE::DuckStation *pine_duckstation_new() { return new PINE::DuckStation(); }
+
+void pine_initialize_batch(PINE::Shared *v) { return v->InitializeBatch(); }
+
+void pine_free_datastream(char *data) { delete[] data; }
+
+int pine_finalize_batch(PINE::Shared *v) {
+    auto batch = v->FinalizeBatch();
+
+    uint32_t index = AcquireSlot();
+    if (index == max_slots)
+        return -1;
+    Slot &slot = GetSlot(index);
+    slot.batch = std::move(batch);
+    slot.owner.store(v, std::memory_order_relaxed);
+    uint32_t generation =
+        slot.generation.fetch_add(1, std::memory_order_release) + 1;
+    return ToHandle(index, generation);
+}
+
+uint64_t pine_get_reply_int(PINE::Shared *v, int cmd, int place,
+                            PINE::Shared::IPCCommand msg) {
+    PINE::Shared::BatchCommand *batch = FindBatch(cmd);
+    if (!batch)
+        return 0;
+    return GetReplyInt(v, *batch, place, msg);
+}
+
+size_t pine_get_replies(PINE::Shared *v, int cmd, int place,
+                        const PINE::Shared::IPCCommand *msgs, uint64_t *out,
+                        size_t count) {
+    PINE::Shared::BatchCommand *batch = FindBatch(cmd);
+    if (!batch || place < 0 || (unsigned int)place >= batch->msg_size)
+        return 0;
+    count = std::min<size_t>(count, batch->msg_size - place);
+    for (size_t i = 0; i < count; i++)
+        out[i] = GetReplyInt(v, *batch, place + i, msgs[i]);
+    return count;
+}
+
+const char *pine_get_reply_string(PINE::Shared *v, int cmd, int place,
+                                  PINE::Shared::IPCCommand msg) {
+    PINE::Shared::BatchCommand *batch = FindBatch(cmd);
+    if (!batch)
+        return nullptr;
+    PINE::Shared::BatchCommand &command = *batch;
+    switch (msg) {
+        case PINE::Shared::MsgVersion:
+            return v->GetReplyView<PINE::Shared::MsgVersion>(command, place)
+                .data();
+        case PINE::Shared::MsgTitle:
+            return v->GetReplyView<PINE::Shared::MsgTitle>(command, place)
+                .data();
+        case PINE::Shared::MsgID:
+            return v->GetReplyView<PINE::Shared::MsgID>(command, place).data();
+        case PINE::Shared::MsgUUID:
+            return v->GetReplyView<PINE::Shared::MsgUUID>(command, place)
+                .data();
+        case PINE::Shared::MsgGameVersion:
+            return v->GetReplyView<PINE::Shared::MsgGameVersion>(command, place)
+                .data();
+        default:
+            return nullptr;
+    }
+}
+
 void pine_send_command(PINE::Shared *v, int cmd) {
-    return v->SendCommand(batch_commands[cmd]);
+    if (PINE::Shared::BatchCommand *batch = FindBatch(cmd))
+        v->SendCommand(*batch);
 }
 
 uint64_t pine_read(PINE::Shared *v, uint32_t address,
@@ -90,6 +257,97 @@ uint64_t pine_read(PINE::Shared *v, uint32_t address,
     }
 }
 
+size_t pine_batch_read_many(PINE::Shared *v, const uint32_t *addresses,
+                            const PINE::Shared::IPCCommand *msgs,
+                            size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        char *cmd;
+        switch (msgs[i]) {
+            case PINE::Shared::MsgRead8:
+                cmd = v->Read<uint8_t, true>(addresses[i]);
+                break;
+            case PINE::Shared::MsgRead16:
+                cmd = v->Read<uint16_t, true>(addresses[i]);
+                break;
+            case PINE::Shared::MsgRead32:
+                cmd = v->Read<uint32_t, true>(addresses[i]);
+                break;
+            case PINE::Shared::MsgRead64:
+                cmd = v->Read<uint64_t, true>(addresses[i]);
+                break;
+            default:
+                cmd = nullptr;
+                break;
+        }
+        if (!cmd)
+            return i;
+    }
+    return count;
+}
+
+uint64_t pine_modify(PINE::Shared *v, uint32_t address,
+                     PINE::Shared::ModifyOp op, uint64_t val,
+                     PINE::Shared::IPCCommand msg, bool batch) {
+    if (!batch) {
+        switch (msg) {
+            case PINE::Shared::MsgModify8:
+                return (uint64_t)v->Modify<uint8_t>(address, op, (uint8_t)val);
+            case PINE::Shared::MsgModify16:
+                return (uint64_t)v->Modify<uint16_t>(address, op,
+                                                     (uint16_t)val);
+            case PINE::Shared::MsgModify32:
+                return (uint64_t)v->Modify<uint32_t>(address, op,
+                                                     (uint32_t)val);
+            case PINE::Shared::MsgModify64:
+                return v->Modify<uint64_t>(address, op, val);
+            default:
+                return 0;
+        }
+    } else {
+        switch (msg) {
+            case PINE::Shared::MsgModify8:
+                v->Modify<uint8_t, true>(address, op, (uint8_t)val);
+                return 0;
+            case PINE::Shared::MsgModify16:
+                v->Modify<uint16_t, true>(address, op, (uint16_t)val);
+                return 0;
+            case PINE::Shared::MsgModify32:
+                v->Modify<uint32_t, true>(address, op, (uint32_t)val);
+                return 0;
+            case PINE::Shared::MsgModify64:
+                v->Modify<uint64_t, true>(address, op, val);
+                return 0;
+            default:
+                return 0;
+        }
+    }
+}
+
+void pine_read_range(PINE::Shared *v, uint32_t address, uint32_t length,
+                     char *dst, bool batch) {
+    if (batch) {
+        v->ReadRange<true>(address, length);
+    } else {
+        v->ReadRange<false>(address, length, dst);
+    }
+}
+
+void pine_write_range(PINE::Shared *v, uint32_t address, const char *src,
+                      uint32_t length, bool batch) {
+    if (batch) {
+        v->WriteRange<true>(address, src, length);
+    } else {
+        v->WriteRange<false>(address, src, length);
+    }
+}
+
+const char *pine_get_reply_range(PINE::Shared *v, int cmd, int place) {
+    PINE::Shared::BatchCommand *batch = FindBatch(cmd);
+    if (!batch)
+        return nullptr;
+    return v->GetReply<PINE::Shared::MsgReadRange>(*batch, place);
+}
+
 void pine_write(PINE::Shared *v, uint32_t address, uint64_t val,
                 PINE::Shared::IPCCommand msg, bool batch) {
     if (!batch) {
@@ -138,6 +396,10 @@ char *pine_version(PINE::Shared *v, bool batch) {
     }
 }
 
+size_t pine_version_buf(PINE::Shared *v, char *buf, size_t size) {
+    return v->Version(buf, size);
+}
+
 PINE::Shared::EmuStatus pine_status(PINE::Shared *v, bool batch) {
     if (batch) {
         v->Status<true>();
@@ -156,6 +418,10 @@ char *pine_getgametitle(PINE::Shared *v, bool batch) {
     }
 }
 
+size_t pine_getgametitle_buf(PINE::Shared *v, char *buf, size_t size) {
+    return v->GetGameTitle(buf, size);
+}
+
 char *pine_getgameid(PINE::Shared *v, bool batch) {
     if (batch) {
         v->GetGameID<true>();
@@ -165,6 +431,10 @@ char *pine_getgameid(PINE::Shared *v, bool batch) {
     }
 }
 
+size_t pine_getgameid_buf(PINE::Shared *v, char *buf, size_t size) {
+    return v->GetGameID(buf, size);
+}
+
 char *pine_getgameuuid(PINE::Shared *v, bool batch) {
     if (batch) {
         v->GetGameUUID<true>();
@@ -174,6 +444,10 @@ char *pine_getgameuuid(PINE::Shared *v, bool batch) {
     }
 }
 
+size_t pine_getgameuuid_buf(PINE::Shared *v, char *buf, size_t size) {
+    return v->GetGameUUID(buf, size);
+}
+
 char *pine_getgameversion(PINE::Shared *v, bool batch) {
     if (batch) {
         v->GetGameVersion<true>();
@@ -183,6 +457,10 @@ char *pine_getgameversion(PINE::Shared *v, bool batch) {
     }
 }
 
+size_t pine_getgameversion_buf(PINE::Shared *v, char *buf, size_t size) {
+    return v->GetGameVersion(buf, size);
+}
+
 void pine_savestate(PINE::Shared *v, uint8_t slot, bool batch) {
     if (batch) {
         v->SaveState<true>(slot);
@@ -203,32 +481,35 @@ PINE::Shared::IPCStatus pine_get_error(PINE::Shared *v) {
     return v->GetError();
 }
 
+void pine_set_timeout(PINE::Shared *v, int timeout_ms) {
+    v->SetTimeout(timeout_ms);
+}
+
 void pine_free_batch_command(int cmd) {
-    batch_commands[cmd] = {};
-    free_batch_command_indices.push_back(cmd);
+    uint32_t generation;
+    Slot *slot = FindSlot(cmd, generation);
+
+    // only one of concurrent frees of a handle gets to free it
+    if (!slot || !slot->generation.compare_exchange_strong(
+                     generation, generation + 1, std::memory_order_acq_rel))
+        return;
+    slot->batch = {};
+    slot->owner.store(nullptr, std::memory_order_relaxed);
+    ReleaseSlot(cmd & (max_slots - 1));
 }
 
 void pine_pcsx2_delete(PINE::PCSX2 *v) {
-    for (long unsigned int i = 0; i < batch_commands.size(); i++)
-        pine_free_batch_command(i);
-    batch_commands.clear();
-    free_batch_command_indices.clear();
+    FreeBatchCommands(v);
     delete v;
 }
 
 void pine_rpcs3_delete(PINE::RPCS3 *v) {
-    for (long unsigned int i = 0; i < batch_commands.size(); i++)
-        pine_free_batch_command(i);
-    batch_commands.clear();
-    free_batch_command_indices.clear();
+    FreeBatchCommands(v);
     delete v;
 }
 
 void pine_duckstation_delete(PINE::DuckStation *v) {
-    for (long unsigned int i = 0; i < batch_commands.size(); i++)
-        pine_free_batch_command(i);
-    batch_commands.clear();
-    free_batch_command_indices.clear();
+    FreeBatchCommands(v);
     delete v;
 }
 }
@@ -54,9 +54,13 @@ EXPORT_LIB void pine_free_datastream(char *data);
 /**
  * In contrast to the C++ library this returns a handle to a struct. @n
  * This requires you to free handles by yourself, see
- * pine_free_batch_command.
+ * pine_free_batch_command. @n
+ * Handles can be used from any thread without locking. Once freed, a handle
+ * is invalid: functions given one do nothing and return 0/nullptr, even if
+ * a new batch command reuses its memory.
  * @see pine_free_batch_command
- * @return PINE::Shared::BatchCommand handle.
+ * @return PINE::Shared::BatchCommand handle, -1 if too many batch commands
+ * are alive.
  * @see PINE::Shared::FinalizeBatch
  */
 EXPORT_LIB int pine_finalize_batch(PINE::Shared *v);
@@ -69,6 +73,34 @@ EXPORT_LIB int pine_finalize_batch(PINE::Shared *v);
 EXPORT_LIB uint64_t pine_get_reply_int(PINE::Shared *v, int cmd, int place,
                                        PINE::Shared::IPCCommand msg);
 
+/**
+ * Vectorized pine_get_reply_int, decoding the integer replies of many
+ * commands of a batch in a single call, eg of pine_batch_read_many. @n
+ * A reply that is not an integer is decoded as 0.
+ * @param cmd PINE::Shared::BatchCommand handle.
+ * @param place Which command to decode the reply of first.
+ * @param msgs The IPC message of each command, eg MsgRead32.
+ * @param out Where to store the replies.
+ * @param count The number of replies to decode.
+ * @return The number of replies decoded, less than count if the batch
+ * command has fewer commands past place.
+ * @see pine_get_reply_int
+ */
+EXPORT_LIB size_t pine_get_replies(PINE::Shared *v, int cmd, int place,
+                                   const PINE::Shared::IPCCommand *msgs,
+                                   uint64_t *out, size_t count);
+
+/**
+ * Variant of PINE::Shared::GetReply that deals with string replies. @n
+ * Unlike the other string functions of the bindings, the returned string is
+ * owned by the batch command: do not free it, and do not use it once the
+ * batch command is sent again or freed.
+ * @see PINE::Shared::GetReplyView
+ */
+EXPORT_LIB const char *pine_get_reply_string(PINE::Shared *v, int cmd,
+                                             int place,
+                                             PINE::Shared::IPCCommand msg);
+
 /**
  * @see PINE::Shared::SendCommand
  */
@@ -80,11 +112,56 @@ EXPORT_LIB void pine_send_command(PINE::Shared *v, int cmd);
 EXPORT_LIB uint64_t pine_read(PINE::Shared *v, uint32_t address,
                               PINE::Shared::IPCCommand msg, bool batch);
 
+/**
+ * Vectorized pine_read, adding many reads to the batch being built in a
+ * single call. @n
+ * Stops at the first read that cannot be added, eg as the batch is full,
+ * pine_get_error telling why.
+ * @param addresses The address of each read.
+ * @param msgs The IPC message of each read, MsgRead8 to MsgRead64.
+ * @param count The number of reads.
+ * @return The number of reads added.
+ * @see pine_read
+ * @see pine_get_replies
+ */
+EXPORT_LIB size_t pine_batch_read_many(PINE::Shared *v,
+                                       const uint32_t *addresses,
+                                       const PINE::Shared::IPCCommand *msgs,
+                                       size_t count);
+
+/**
+ * @see PINE::Shared::ReadRange
+ */
+EXPORT_LIB void pine_read_range(PINE::Shared *v, uint32_t address,
+                                uint32_t length, char *dst, bool batch);
+
+/**
+ * @see PINE::Shared::WriteRange
+ */
+EXPORT_LIB void pine_write_range(PINE::Shared *v, uint32_t address,
+                                 const char *src, uint32_t length, bool batch);
+
+/**
+ * Variant of PINE::Shared::GetReply that deals with MsgReadRange replies. @n
+ * The returned pointer is owned by the batch command, do not free it.
+ * @see PINE::Shared::GetReply
+ */
+EXPORT_LIB const char *pine_get_reply_range(PINE::Shared *v, int cmd,
+                                            int place);
+
 /**
  * @see PINE::Shared::Version
  */
 EXPORT_LIB char *pine_version(PINE::Shared *v, bool batch);
 
+/**
+ * Non-owning variant of pine_version: the version is copied into buf, and
+ * nothing has to be freed with pine_free_datastream.
+ * @return The length of the version string, truncated if >= size.
+ * @see PINE::Shared::Version
+ */
+EXPORT_LIB size_t pine_version_buf(PINE::Shared *v, char *buf, size_t size);
+
 /**
  * @see PINE::Shared::Status
  */
@@ -95,21 +172,55 @@ EXPORT_LIB PINE::Shared::EmuStatus pine_status(PINE::Shared *v, bool batch);
  */
 EXPORT_LIB char *pine_getgametitle(PINE::Shared *v, bool batch);
 
+/**
+ * Non-owning variant of pine_getgametitle: the title is copied into buf, and
+ * nothing has to be freed with pine_free_datastream.
+ * @return The length of the title string, truncated if >= size.
+ * @see PINE::Shared::GetGameTitle
+ */
+EXPORT_LIB size_t pine_getgametitle_buf(PINE::Shared *v, char *buf,
+                                        size_t size);
+
 /**
  * @see PINE::Shared::GetGameID
  */
 EXPORT_LIB char *pine_getgameid(PINE::Shared *v, bool batch);
 
+/**
+ * Non-owning variant of pine_getgameid: the ID is copied into buf, and
+ * nothing has to be freed with pine_free_datastream.
+ * @return The length of the ID string, truncated if >= size.
+ * @see PINE::Shared::GetGameID
+ */
+EXPORT_LIB size_t pine_getgameid_buf(PINE::Shared *v, char *buf, size_t size);
+
 /**
  * @see PINE::Shared::GetGameUUID
  */
 EXPORT_LIB char *pine_getgameuuid(PINE::Shared *v, bool batch);
 
+/**
+ * Non-owning variant of pine_getgameuuid: the UUID is copied into buf, and
+ * nothing has to be freed with pine_free_datastream.
+ * @return The length of the UUID string, truncated if >= size.
+ * @see PINE::Shared::GetGameUUID
+ */
+EXPORT_LIB size_t pine_getgameuuid_buf(PINE::Shared *v, char *buf, size_t size);
+
 /**
  * @see PINE::Shared::GetGameVersion
  */
 EXPORT_LIB char *pine_getgameversion(PINE::Shared *v, bool batch);
 
+/**
+ * Non-owning variant of pine_getgameversion: the game version is copied into
+ * buf, and nothing has to be freed with pine_free_datastream.
+ * @return The length of the game version string, truncated if >= size.
+ * @see PINE::Shared::GetGameVersion
+ */
+EXPORT_LIB size_t pine_getgameversion_buf(PINE::Shared *v, char *buf,
+                                          size_t size);
+
 /**
  * @see PINE::Shared::SaveState
  */
@@ -120,6 +231,13 @@ EXPORT_LIB void pine_savestate(PINE::Shared *v, uint8_t slot, bool batch);
  */
 EXPORT_LIB void pine_loadstate(PINE::Shared *v, uint8_t slot, bool batch);
 
+/**
+ * @see PINE::Shared::Modify
+ */
+EXPORT_LIB uint64_t pine_modify(PINE::Shared *v, uint32_t address,
+                                PINE::Shared::ModifyOp op, uint64_t val,
+                                PINE::Shared::IPCCommand msg, bool batch);
+
 /**
  * @see PINE::Shared::Write
  */
@@ -127,16 +245,19 @@ EXPORT_LIB void pine_write(PINE::Shared *v, uint32_t address, uint64_t val,
                            PINE::Shared::IPCCommand msg, bool batch);
 
 /**
+ * Also frees the batch commands it finalized.
  * @see PINE::~PCSX2
  */
 EXPORT_LIB void pine_pcsx2_delete(PINE::PCSX2 *v);
 
 /**
+ * Also frees the batch commands it finalized.
  * @see PINE::~RPCS3
  */
 EXPORT_LIB void pine_rpcs3_delete(PINE::RPCS3 *v);
 
 /**
+ * Also frees the batch commands it finalized.
  * @see PINE::~DuckStation
  */
 EXPORT_LIB void pine_duckstation_delete(PINE::DuckStation *v);
@@ -144,7 +265,9 @@ EXPORT_LIB void pine_duckstation_delete(PINE::DuckStation *v);
 /**
  * Frees given PINE::Shared::BatchCommand through its int handle. @n
  * As the C bindings handle structures for you, you have to tell them when to
- * free the batch commands if you want to free memory.
+ * free the batch commands if you want to free memory. @n
+ * Freeing a handle that is already freed does nothing, but a handle must not
+ * be freed while another thread still uses it.
  * @param cmd PINE::Shared::BatchCommand handle.
  */
 EXPORT_LIB void pine_free_batch_command(int cmd);
@@ -153,6 +276,11 @@ EXPORT_LIB void pine_free_batch_command(int cmd);
  */
 EXPORT_LIB PINE::Shared::IPCStatus pine_get_error(PINE::Shared *v);
 
+/**
+ * @see PINE::Shared::SetTimeout
+ */
+EXPORT_LIB void pine_set_timeout(PINE::Shared *v, int timeout_ms);
+
 #ifdef __cplusplus
 }
 #endif
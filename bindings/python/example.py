@@ -18,8 +18,10 @@ elif(cur_os == "Darwin"):
 # refer to bindings/c to build the library.
 libipc = ctypes.CDLL(os.path.join(os.path.dirname(os.path.abspath(__file__)),lib))
 
-# we create a new PCSX2Ipc object
-ipc = libipc.pine_pcsx2_new()
+# we create a new PCSX2Ipc object, a pointer ctypes would truncate to an int
+# if not told otherwise
+libipc.pine_pcsx2_new.restype = ctypes.c_void_p
+ipc = ctypes.c_void_p(libipc.pine_pcsx2_new())
 
 # we read an uint8_t from memory location 0x00347D34
 print(libipc.pine_read(ipc, 0x00347D34, 0, False))
@@ -27,6 +29,20 @@ print(libipc.pine_read(ipc, 0x00347D34, 0, False))
 # we check for errors
 print("Error (if any): " + str(libipc.pine_get_error(ipc)))
 
+# we read 1024 uint32_t in a single batch, with one call to build it and one
+# to get its replies back, rather than one per value
+count = 1024
+addresses = (ctypes.c_uint32 * count)(*[0x00347D34 + i * 4 for i in range(count)])
+msgs = (ctypes.c_uint8 * count)(*[2] * count)  # MsgRead32
+replies = (ctypes.c_uint64 * count)()
+libipc.pine_initialize_batch(ipc)
+libipc.pine_batch_read_many(ipc, addresses, msgs, ctypes.c_size_t(count))
+batch = libipc.pine_finalize_batch(ipc)
+libipc.pine_send_command(ipc, batch)
+libipc.pine_get_replies(ipc, batch, 0, msgs, replies, ctypes.c_size_t(count))
+print(list(replies[:4]))
+libipc.pine_free_batch_command(batch)
+
 # we delete the object and free the resources
 libipc.pine_pcsx2_delete(ipc)
 
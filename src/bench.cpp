@@ -0,0 +1,258 @@
+// Benchmarks of the PINE client library.
+//
+// By default this runs against the reference server, started in-process, so
+// that the numbers only depend on the library and the transport; pass
+// --external to measure a running emulator instead. Results are printed on
+// stdout as JSON so that they can be tracked across releases.
+//
+// usage: bench [--external] [--samples N]
+//
+// WARNING: against an emulator the write benchmarks keep writing back the
+// value they read once before starting, undoing whatever the game writes there
+// in the meantime: do not run this in the middle of something you care about.
+
+#include "pine.h"
+#include "pine_server.h"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+// an address in EE RAM which is safe to read from on every emulator we bench
+static const uint32_t base_address = 0x00100000;
+
+// number of requests each thread sends in the contention benchmark
+static const int contention_requests = 20000;
+
+// the batch sizes we measure, the last one is split over multiple packets
+static const int batch_sizes[] = { 1, 10, 100, 1000, 10000, 100000 };
+
+// the thread counts we measure the contention with
+static const int thread_counts[] = { 1, 2, 4, 8 };
+
+// the JSON document, only printed once every benchmark succeeded for a
+// failure not to leave half of one on stdout
+static std::string output;
+
+// appends printf-style formatted text to the output
+static auto print(const char *format, ...) -> void {
+    va_list args, again;
+    va_start(args, format);
+    va_copy(again, args);
+    int len = vsnprintf(nullptr, 0, format, args);
+    va_end(args);
+    size_t end = output.size();
+    output.resize(end + len + 1);
+    vsnprintf(&output[end], len + 1, format, again);
+    va_end(again);
+    output.resize(end + len);
+}
+
+// prints a JSON object member, comma included where needed
+static auto member(bool &first, const char *name) -> void {
+    print("%s\"%s\": ", first ? "" : ", ", name);
+    first = false;
+}
+
+// prints a JSON string, escaping what needs to be
+static auto string(const char *str) -> void {
+    output += '"';
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\')
+            output += '\\';
+        if ((unsigned char)*str >= 0x20)
+            output += *str;
+    }
+    output += '"';
+}
+
+// times `samples` calls of f and prints their latency distribution
+template <typename F>
+static auto latency(bool &first, const char *name, int samples, F &&f)
+    -> void {
+    std::vector<double> ns(samples);
+
+    // warm up the connection and caches before measuring anything
+    for (int i = 0; i < samples / 10; i++)
+        f();
+
+    for (int i = 0; i < samples; i++) {
+        auto start = bench_clock::now();
+        f();
+        ns[i] = std::chrono::duration<double, std::nano>(bench_clock::now() -
+                                                        start)
+                    .count();
+    }
+    std::sort(ns.begin(), ns.end());
+
+    double total = 0;
+    for (double v : ns)
+        total += v;
+    auto percentile = [&](double p) {
+        return ns[std::min<size_t>(samples - 1, samples * p)];
+    };
+
+    member(first, name);
+    print("{ \"samples\": %d, \"mean_ns\": %.0f, \"p50_ns\": %.0f, "
+           "\"p99_ns\": %.0f, \"p999_ns\": %.0f }",
+           samples, total / samples, percentile(0.5), percentile(0.99),
+           percentile(0.999));
+}
+
+// runs every benchmark against a connection opened with `flags`
+static auto run(const char *transport, unsigned int flags, int samples)
+    -> void {
+    PINE::PCSX2 ipc(0, flags);
+    bool first = true;
+
+    print("    { \"transport\": \"%s\",\n", transport);
+
+    // single command latency
+    print("      \"latency\": { ");
+    uint32_t value = ipc.Read<uint32_t>(base_address);
+    latency(first, "Read32", samples,
+            [&] { return ipc.Read<uint32_t>(base_address); });
+    latency(first, "Write32", samples,
+            [&] { ipc.Write<uint32_t>(base_address, value); });
+    latency(first, "Read64", samples,
+            [&] { return ipc.Read<uint64_t>(base_address); });
+    print(" },\n");
+
+    // string commands, allocating a new string or filling our own buffer
+    first = true;
+    print("      \"strings\": { ");
+    latency(first, "Version", samples, [&] { delete[] ipc.Version(); });
+    latency(first, "Version_buffer", samples, [&] {
+        char version[256];
+        return ipc.Version(version, sizeof(version));
+    });
+    latency(first, "GetGameTitle_buffer", samples, [&] {
+        char title[256];
+        return ipc.GetGameTitle(title, sizeof(title));
+    });
+    print(" },\n");
+
+    // batch throughput, we build the batch once and resend it as a real
+    // client would do
+    print("      \"batch\": [");
+    first = true;
+    for (int size : batch_sizes) {
+        ipc.InitializeBatch();
+        for (int i = 0; i < size; i++)
+            ipc.Read<uint32_t, true>(base_address + i * 4);
+        auto batch = ipc.FinalizeBatch();
+
+        int rounds = std::max(3, samples / size);
+        ipc.SendCommand(batch);
+        auto start = bench_clock::now();
+        for (int i = 0; i < rounds; i++)
+            ipc.SendCommand(batch);
+        double ns = std::chrono::duration<double, std::nano>(
+                        bench_clock::now() - start)
+                        .count();
+
+        print("%s\n        { \"size\": %d, \"packets\": %u, \"rounds\": %d, "
+               "\"ns_per_batch\": %.0f, \"commands_per_second\": %.0f }",
+               first ? "" : ",", size, batch.frames, rounds, ns / rounds,
+               (double)size * rounds * 1e9 / ns);
+        first = false;
+    }
+    print("\n      ],\n");
+
+    // multiple threads hammering the same Shared object, either through one
+    // connection or through a pool of them
+    print("      \"contention\": [");
+    first = true;
+    for (unsigned int pool : { PINE::Shared::DefaultSession,
+                               PINE::Shared::ConnectionPool }) {
+        for (int count : thread_counts) {
+            PINE::PCSX2 shared(0, flags | pool);
+            std::vector<std::thread> threads;
+            auto start = bench_clock::now();
+            for (int t = 0; t < count; t++)
+                threads.emplace_back([&] {
+                    for (int i = 0; i < contention_requests; i++)
+                        shared.Read<uint32_t>(base_address);
+                });
+            for (auto &thread : threads)
+                thread.join();
+            double ns = std::chrono::duration<double, std::nano>(
+                            bench_clock::now() - start)
+                            .count();
+
+            print("%s\n        { \"threads\": %d, \"connection_pool\": %s, "
+                   "\"requests\": %d, \"requests_per_second\": %.0f }",
+                   first ? "" : ",", count, pool ? "true" : "false",
+                   count * contention_requests,
+                   (double)count * contention_requests * 1e9 / ns);
+            first = false;
+        }
+    }
+    print("\n      ]\n    }");
+}
+
+auto main(int argc, char *argv[]) -> int {
+    bool external = false;
+    int samples = 100000;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--external") == 0) {
+            external = true;
+        } else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+            samples = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--external] [--samples N]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (samples < 10) {
+        fprintf(stderr, "we need at least 10 samples\n");
+        return 1;
+    }
+
+    // no emulator to bench against, the reference server stands in for it
+    std::unique_ptr<PINE::PCSX2Server> server;
+    if (!external) {
+        server = std::make_unique<PINE::PCSX2Server>();
+        if (!server->Start()) {
+            fprintf(stderr, "could not start the reference server, is an "
+                            "emulator already running?\n");
+            return 1;
+        }
+    }
+
+    try {
+        PINE::PCSX2 ipc;
+        char version[256];
+        ipc.Version(version, sizeof(version));
+
+        print("{\n  \"server\": ");
+        string(version);
+        print(",\n  \"samples\": %d,\n  \"runs\": [\n", samples);
+        run("socket", PINE::Shared::DefaultSession, samples);
+#ifdef __linux__
+        // emulators or kernels not supporting them transparently fall back
+        // to the socket, which is still worth knowing about
+        print(",\n");
+        run("shared_memory", PINE::Shared::SharedMemory, samples);
+        print(",\n");
+        run("io_uring", PINE::Shared::IoUring, samples);
+#endif
+        print("\n  ]\n}\n");
+        fputs(output.c_str(), stdout);
+    } catch (...) {
+        fprintf(stderr, "the benchmark failed, is the emulator running?\n");
+        return 1;
+    }
+
+    return 0;
+}
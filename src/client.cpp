@@ -23,15 +23,19 @@ auto msleep(int sleepMs) -> void {
 // how timers can work
 auto read_background(PINE::PCSX2 *ipc) -> void {
     while (true) {
-        // you can go slower but go higher at your own risk
+        // you can go slower but go higher at your own risk. Emulators
+        // implementing ExecuteOnFrameEnd let you wait for the next frame
+        // instead.
         msleep(100);
 
         try {
             // WARNING: all datastreams that are returned by the library changes
             // ownership, it is your duty to free them after use.
-            char *title = ipc->GetGameTitle();
+            // As we poll here, we rather give it a buffer of our own to fill
+            // in, which avoids allocating a new string every time.
+            char title[256];
+            ipc->GetGameTitle(title, sizeof(title));
             printf("%s\n", title);
-            delete[] title;
         } catch (...) {
             // if the operation failed
             printf("ERROR!!!!!\n");
@@ -43,7 +47,10 @@ auto read_background(PINE::PCSX2 *ipc) -> void {
 auto main(int argc, char *argv[]) -> int {
 
     // we instantiate a new PINE::PCSX2 object. It should be shared across all
-    // your threads.
+    // your threads. By default they all share a single connection to the
+    // emulator; if your threads have to talk with it concurrently pass
+    // PINE::PCSX2::ConnectionPool as a second argument to give each of them
+    // its own.
     PINE::PCSX2 *ipc = new PINE::PCSX2();
 
     // we create a new thread
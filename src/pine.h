@@ -1,33 +1,74 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <string>
+#include <string_view>
 #include <sys/types.h>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #ifdef _WIN32
 #define read_portable(a, b, c) (recv(a, b, c, 0))
 #define write_portable(a, b, c) (send(a, b, c, 0))
+// client sockets are non-blocking as a whole on windows, see InitSocket
+#define write_nonblock_portable(a, b, c) (send(a, b, c, 0))
+#define would_block_portable() (WSAGetLastError() == WSAEWOULDBLOCK)
+#define poll_portable(a, b, c) (WSAPoll(a, b, c))
 #define close_portable(a) (closesocket(a))
+#define invalid_socket_portable INVALID_SOCKET
 #include <windows.h>
 #elif defined(__linux__) || defined(__FreeBSD__)
 #define read_portable(a, b, c) (read(a, b, c))
 #define write_portable(a, b, c) (send(a, b, c, MSG_NOSIGNAL))
+#define write_nonblock_portable(a, b, c)                                       \
+    (send(a, b, c, MSG_NOSIGNAL | MSG_DONTWAIT))
+#define would_block_portable() (errno == EAGAIN || errno == EWOULDBLOCK)
+#define poll_portable(a, b, c) (poll(a, b, c))
 #define close_portable(a) (close(a))
+#define invalid_socket_portable (-1)
+#include <dirent.h>
+#include <errno.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/un.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <linux/io_uring.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
 #else
 #define read_portable(a, b, c) (read(a, b, c))
 #define write_portable(a, b, c) (write(a, b, c))
+#define write_nonblock_portable(a, b, c) (send(a, b, c, MSG_DONTWAIT))
+#define would_block_portable() (errno == EAGAIN || errno == EWOULDBLOCK)
+#define poll_portable(a, b, c) (poll(a, b, c))
 #define close_portable(a) (close(a))
+#define invalid_socket_portable (-1)
+#include <dirent.h>
+#include <errno.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/un.h>
 #include <unistd.h>
 #endif
@@ -48,9 +89,9 @@
  * it more easily extensible, more portable, require less code and be more
  * performant. @n
  *
- * Event based commands such as ExecuteOnFrameEnd (not yet implemented) can thus
- * be a blocking socket event, which is then noticed by our API, executes out
- * IPC commands and then tells the game to resume. Thanks to the speed of the
+ * Event based commands such as ExecuteOnFrameEnd can thus be a blocking socket
+ * event, which is then noticed by our API, executes out IPC commands and then
+ * tells the game to resume. Thanks to the speed of the
  * IPC even complex events can be outsourced from the emulator, thus keeping
  * the main codebase lean and minimal. @n
  *
@@ -84,7 +125,17 @@ void hexdump(void *ptr, int buflen) {
 
 #endif
 
+class Server;
+
 class Shared {
+    // the reference server shares our protocol helpers
+    friend class Server;
+
+  public:
+    struct BatchCommand;
+    struct ShmRegion;
+    enum IPCStatus : unsigned int;
+
     // allow test suite to poke internals
   protected:
     /**
@@ -93,22 +144,6 @@ class Shared {
      */
     uint16_t slot;
 
-#if defined(_WIN32) || defined(DOXYGEN)
-    /**
-     * Socket handler. @n
-     * On windows it uses the type SOCKET, on linux int.
-     */
-    SOCKET sock = INVALID_SOCKET;
-#else
-    int sock = -1;
-#endif
-
-    /**
-     * Socket initialization state. @n
-     * True if initialized, false if not or if impossible to connect to.
-     */
-    bool sock_state = false;
-
 #if !defined(_WIN32) || defined(DOXYGEN)
     /**
      * Unix socket name. @n
@@ -135,92 +170,638 @@ class Shared {
 #define MAX_IPC_RETURN_SIZE 450000
 
     /**
-     * Maximum number of commands sent in a batch message.
+     * Maximum number of commands sent in a batch message. @n
+     * Batches going over any of these limits are split in multiple messages.
      * @see MAX_IPC_RETURN_SIZE
      * @see MAX_IPC_SIZE
      */
 #define MAX_BATCH_REPLY_COUNT 50000
 
     /**
-     * IPC return buffer. @n
-     * A preallocated buffer used to store all IPC replies.
-     * @see ipc_buffer
-     * @see MAX_IPC_RETURN_SIZE
+     * Size of each ring of the shared memory transport. @n
+     * Must be a power of two, and big enough to hold MAX_IPC_SIZE.
+     * @see ShmRing
      */
-    char *ret_buffer;
+#define SHM_RING_SIZE (1 << 20)
 
     /**
-     * IPC messages buffer. @n
-     * A preallocated buffer used to store all IPC messages.
-     * @see ret_buffer
-     * @see MAX_IPC_SIZE
+     * Identifies a shared memory region of this version of the transport.
+     * @see ShmRegion
      */
-    char *ipc_buffer;
+#define SHM_MAGIC 0x454E4950
 
     /**
-     * Length of the batch IPC request. @n
-     * This is used when chaining multiple IPC commands in one go to store the
-     * current size of the packet chain.
-     * @see IPCCommand
-     * @see MAX_IPC_SIZE
+     * How long, in ms, to sleep on a shared memory ring before checking
+     * whether the other side is still alive.
+     * @see ShmRing::Wait
      */
-    unsigned int batch_len = 0;
+#define SHM_TIMEOUT 100
 
     /**
-     * Length of the reply of the batch IPC request. @n
-     * This is used when chaining multiple IPC commands in one go
-     * to store the length of the reply of the IPC message.
-     * @see IPCCommand
-     * @see MAX_IPC_RETURN_SIZE
+     * How long, in ms, to wait before connecting again after a failed
+     * attempt. Doubled on every failure, up to RECONNECT_MAX_DELAY; commands
+     * fail right away with NoConnection in the meantime.
+     * @see Connection::retry_at
      */
-    unsigned int reply_len = 0;
+#define RECONNECT_MIN_DELAY 10
 
     /**
-     * Whether a batch command reply needs relocation. @n
-     * This automatically sets up the reply size to be the
-     * maximum possible since we cannot anticipate how much
-     * resources this will take.
-     * @see IPCCommand
-     * @see MAX_IPC_RETURN_SIZE
+     * Longest delay, in ms, between two connection attempts.
+     * @see RECONNECT_MIN_DELAY
      */
-    bool needs_reloc = false;
+#define RECONNECT_MAX_DELAY 1000
 
     /**
-     * Number of IPC messages of the batch IPC request. @n
-     * This is used when chaining multiple IPC commands in one go
-     * to store the number of IPC messages chained together.
-     * @see IPCCommand
-     * @see MAX_BATCH_REPLY_COUNT
+     * How long, in ms, the rest of an event can take to come once it started
+     * to. Past it, the event connection is considered lost.
+     * @see ReadEvents
      */
-    unsigned int arg_cnt = 0;
+#define EVENT_READ_TIMEOUT 1000
 
+#if defined(__linux__) || defined(DOXYGEN)
     /**
-     * Position of the batch arguments. @n
-     * This is used when chaining multiple IPC commands in one go.
-     * Stores the location of each message reply in the buffer
-     * sent by FinalizeBatch.
-     * @see FinalizeBatch
-     * @see IPCCommand
-     * @see MAX_BATCH_REPLY_COUNT
+     * io_uring instance of a connection. @n
+     * Submits an IPC message along with the read of its reply, linked, so
+     * that a command costs a single syscall instead of a write and a loop of
+     * reads. The reply buffer of the connection is registered with the
+     * kernel, which then does not have to map it on every read.
+     * @see IoUring
+     */
+    struct IoRing {
+        /**
+         * Sets up an io_uring instance.
+         * @param ret_buffer The reply buffer of the connection, to register.
+         * @return The instance, or nullptr if io_uring is unavailable.
+         */
+        static auto Create(char *ret_buffer) -> IoRing * {
+            struct io_uring_params params = {};
+            int fd = syscall(SYS_io_uring_setup, 4, &params);
+            if (fd < 0)
+                return nullptr;
+            // without fast poll every read of a socket would be handed over
+            // to a kernel thread, which is slower than the syscalls we save.
+            IoRing *ring = new IoRing(fd, params, ret_buffer);
+            if (!(params.features & IORING_FEAT_FAST_POLL) || !ring->sqes) {
+                delete ring;
+                return nullptr;
+            }
+            return ring;
+        }
+
+        /**
+         * Writes an IPC message to a socket and reads the beginning of its
+         * reply, if the message could be written in full.
+         * @param sock The socket to use.
+         * @param cmd The IPC message.
+         * @param cmd_len Its size.
+         * @param dst Where to store the reply.
+         * @param len The maximum number of bytes to read.
+         * @param received Set to the number of bytes read.
+         * @param timeout_ms How long to wait for the reply, -1 for forever.
+         * @return The number of bytes written, the rest is up to the caller.
+         */
+        auto Exchange(int sock, const char *cmd, int cmd_len, char *dst,
+                      int len, int &received, int timeout_ms) -> int {
+            unsigned int tail = *sq_tail;
+            struct io_uring_sqe *write = &sqes[tail & *sq_mask];
+            struct io_uring_sqe *read = &sqes[(tail + 1) & *sq_mask];
+            sq_array[tail & *sq_mask] = tail & *sq_mask;
+            sq_array[(tail + 1) & *sq_mask] = (tail + 1) & *sq_mask;
+
+            // a short write fails the link, and with it the read, which
+            // would otherwise wait for a reply to a message never sent.
+            *write = {};
+            write->opcode = IORING_OP_SEND;
+            write->flags = IOSQE_IO_LINK;
+            write->fd = sock;
+            write->addr = (uint64_t)cmd;
+            write->len = cmd_len;
+            write->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+            write->user_data = 0;
+
+            *read = {};
+            bool fixed = registered && dst >= ret_buffer &&
+                         dst + len <= ret_buffer + MAX_IPC_RETURN_SIZE;
+            read->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_RECV;
+            read->fd = sock;
+            read->addr = (uint64_t)dst;
+            read->len = len;
+            read->user_data = 1;
+
+            // the read is cancelled once the deadline is past, the caller
+            // then finds out it has no time left.
+            unsigned int count = 2;
+            struct __kernel_timespec deadline = {
+                timeout_ms / 1000, (timeout_ms % 1000) * 1000000LL
+            };
+            if (timeout_ms >= 0) {
+                struct io_uring_sqe *timer = &sqes[(tail + 2) & *sq_mask];
+                sq_array[(tail + 2) & *sq_mask] = (tail + 2) & *sq_mask;
+                read->flags = IOSQE_IO_LINK;
+                *timer = {};
+                timer->opcode = IORING_OP_LINK_TIMEOUT;
+                timer->addr = (uint64_t)&deadline;
+                timer->len = 1;
+                timer->user_data = 2;
+                count = 3;
+            }
+            std::atomic_ref<unsigned int>(*sq_tail).store(
+                tail + count, std::memory_order_release);
+
+            int results[3] = { 0, 0, 0 };
+            unsigned int reaped = 0;
+            unsigned int submit = count;
+            while (reaped < count) {
+                unsigned int head = *cq_head;
+                unsigned int ready = std::atomic_ref<unsigned int>(*cq_tail)
+                                         .load(std::memory_order_acquire);
+                for (; head != ready; head++, reaped++) {
+                    struct io_uring_cqe &cqe = cqes[head & *cq_mask];
+                    results[cqe.user_data] = cqe.res;
+                }
+                std::atomic_ref<unsigned int>(*cq_head).store(
+                    head, std::memory_order_release);
+                if (reaped == count)
+                    break;
+                int entered = syscall(SYS_io_uring_enter, fd, submit,
+                                      count - reaped, IORING_ENTER_GETEVENTS,
+                                      nullptr, 0);
+                if (entered >= 0)
+                    submit -= std::min<unsigned int>(entered, submit);
+                else if (errno != EINTR)
+                    break;
+            }
+            if (reaped < count) {
+                // the ring is in an unknown state, let the caller fall back
+                // to the socket for good.
+                broken = true;
+                received = 0;
+                return 0;
+            }
+            received = std::max(results[1], 0);
+            return std::max(results[0], 0);
+        }
+
+        IoRing(int fd, const struct io_uring_params &params, char *ret_buffer)
+            : fd(fd), ret_buffer(ret_buffer) {
+            sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_len = params.cq_off.cqes +
+                     params.cq_entries * sizeof(struct io_uring_cqe);
+            if (params.features & IORING_FEAT_SINGLE_MMAP)
+                sq_len = cq_len = std::max(sq_len, cq_len);
+            sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+            void *sq = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            if (sq == MAP_FAILED)
+                return;
+            sq_ring = (char *)sq;
+            void *cq = sq;
+            if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+                cq = mmap(nullptr, cq_len, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+                if (cq == MAP_FAILED)
+                    return;
+            }
+            cq_ring = (char *)cq;
+            void *entries =
+                mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+            if (entries == MAP_FAILED)
+                return;
+
+            sq_tail = (unsigned int *)(sq_ring + params.sq_off.tail);
+            sq_mask = (unsigned int *)(sq_ring + params.sq_off.ring_mask);
+            sq_array = (unsigned int *)(sq_ring + params.sq_off.array);
+            cq_head = (unsigned int *)(cq_ring + params.cq_off.head);
+            cq_tail = (unsigned int *)(cq_ring + params.cq_off.tail);
+            cq_mask = (unsigned int *)(cq_ring + params.cq_off.ring_mask);
+            cqes = (struct io_uring_cqe *)(cq_ring + params.cq_off.cqes);
+            sqes = (struct io_uring_sqe *)entries;
+
+            // pinning memory is subject to RLIMIT_MEMLOCK, reads into
+            // unregistered buffers still work when it is too low.
+            struct iovec iov = { ret_buffer, MAX_IPC_RETURN_SIZE };
+            registered = syscall(SYS_io_uring_register, fd,
+                                 IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+        }
+
+        ~IoRing() {
+            if (sqes)
+                munmap(sqes, sqes_len);
+            if (cq_ring && cq_ring != sq_ring)
+                munmap(cq_ring, cq_len);
+            if (sq_ring)
+                munmap(sq_ring, sq_len);
+            close(fd);
+        }
+
+        IoRing(const IoRing &rhs) = delete;
+        IoRing &operator=(const IoRing &rhs) = delete;
+
+        /**
+         * Whether a syscall failed in a way we cannot recover from.
+         */
+        bool broken = false;
+
+      private:
+        int fd;
+        char *ret_buffer;
+        bool registered = false;
+        char *sq_ring = nullptr;
+        char *cq_ring = nullptr;
+        size_t sq_len, cq_len, sqes_len;
+        unsigned int *sq_tail, *sq_mask, *sq_array;
+        unsigned int *cq_head, *cq_tail, *cq_mask;
+        struct io_uring_sqe *sqes = nullptr;
+        struct io_uring_cqe *cqes;
+    };
+#endif
+
+    /**
+     * IPC connection state. @n
+     * Everything needed to build and exchange IPC messages over one socket.
+     * @n A session owns a single connection shared by all threads, unless
+     * ConnectionPool is set, in which case every thread gets its own.
+     * @see SessionFlags
+     * @see Conn
+     */
+    struct Connection {
+#if defined(_WIN32) || defined(DOXYGEN)
+        /**
+         * Socket handler. @n
+         * On windows it uses the type SOCKET, on linux int.
+         */
+        SOCKET sock = INVALID_SOCKET;
+#else
+        int sock = -1;
+#endif
+
+        /**
+         * Socket initialization state. @n
+         * True if initialized, false if not or if impossible to connect to.
+         */
+        bool sock_state = false;
+
+#if !defined(_WIN32) || defined(DOXYGEN)
+        /**
+         * Unix socket path. @n
+         * Overrides the one of the session when set, to reach another
+         * instance of the emulator.
+         * @see SOCKET_NAME
+         */
+        std::string path;
+#endif
+
+        /**
+         * IPC return buffer. @n
+         * A preallocated buffer used to store all IPC replies.
+         * @see ipc_buffer
+         * @see MAX_IPC_RETURN_SIZE
+         */
+        char *ret_buffer = nullptr;
+
+        /**
+         * IPC messages buffer. @n
+         * A preallocated buffer used to store all IPC messages.
+         * @see ret_buffer
+         * @see MAX_IPC_SIZE
+         */
+        char *ipc_buffer = nullptr;
+
+        /**
+         * Length of the batch IPC request. @n
+         * This is used when chaining multiple IPC commands in one go to store
+         * the current size of the packet chain.
+         * @see IPCCommand
+         * @see MAX_IPC_SIZE
+         */
+        unsigned int batch_len = 0;
+
+        /**
+         * Length of the reply of the batch IPC request. @n
+         * This is used when chaining multiple IPC commands in one go
+         * to store the length of the reply of the IPC message.
+         * @see IPCCommand
+         * @see MAX_IPC_RETURN_SIZE
+         */
+        unsigned int reply_len = 0;
+
+        /**
+         * Whether a batch command reply needs relocation. @n
+         * As we cannot anticipate how much resources this will take, the
+         * reply buffer is then grown upon receiving the reply.
+         * @see IPCCommand
+         * @see MAX_IPC_RETURN_SIZE
+         */
+        bool needs_reloc = false;
+
+        /**
+         * Number of IPC messages of the batch IPC request. @n
+         * This is used when chaining multiple IPC commands in one go
+         * to store the number of IPC messages chained together.
+         * @see IPCCommand
+         * @see MAX_BATCH_REPLY_COUNT
+         */
+        unsigned int arg_cnt = 0;
+
+        /**
+         * Position of the batch arguments. @n
+         * This is used when chaining multiple IPC commands in one go.
+         * Stores the location of each message reply in the buffer
+         * sent by FinalizeBatch.
+         * @see FinalizeBatch
+         * @see IPCCommand
+         * @see MAX_BATCH_REPLY_COUNT
+         */
+        unsigned int *batch_arg_place = nullptr;
+
+        /**
+         * Frames of the batch IPC request that are already full. @n
+         * A batch too big for a single IPC message is split into several
+         * ones: whenever the one being built in ipc_buffer is full it is
+         * moved here and a new one is started.
+         * @see SpillFrame
+         * @see MAX_IPC_SIZE
+         */
+        std::vector<char> spilled_batch;
+
+        /**
+         * Position of the batch arguments of the spilled frames. @n
+         * Unlike batch_arg_place, these are relative to the start of the
+         * reply of the whole batch.
+         * @see spilled_batch
+         */
+        std::vector<unsigned int> spilled_arg_place;
+
+        /**
+         * Length of the replies of the spilled frames.
+         * @see spilled_batch
+         */
+        unsigned int spilled_reply_len = 0;
+
+        /**
+         * Number of spilled frames.
+         * @see spilled_batch
+         */
+        unsigned int spilled_frames = 0;
+
+        /**
+         * Conditional blocks of the batch IPC request still open. @n
+         * Stores, for each of them, the index of its MsgIf among the
+         * commands of the batch and the location of its command count in
+         * ipc_buffer.
+         * @see BeginIf
+         */
+        std::vector<std::pair<unsigned int, unsigned int>> conditions;
+
+        /**
+         * Sets the state of the batch command building. @n
+         * This is used when chaining multiple IPC commands in one go. @n
+         * As we cannot build multiple batch IPC commands at the same time
+         * because of state keeping issues we block the initialization of
+         * another batch request until the other ends.
+         */
+        std::mutex batch_blocking;
+
+        /**
+         * Whether a batch is being built, batch_blocking and ipc_blocking
+         * being held by the thread building it.
+         */
+        bool batching = false;
+
+        /**
+         * Sets the state of the IPC message building. @n
+         * As we cannot build multiple batch IPC commands at the same time
+         * because of state keeping issues we block the initialization of
+         * another message request until the other ends.
+         */
+        std::mutex ipc_blocking;
+
+        /**
+         * A batch command submitted without waiting for its reply.
+         * @see Submit
+         */
+        struct InFlight {
+            uint64_t ticket;         /**< Ticket handed out by Submit. */
+            const BatchCommand *cmd; /**< Command awaiting its reply. */
+            bool done;               /**< Whether its reply was read. */
+            IPCStatus status;        /**< Its result, once done. */
+        };
+
+        /**
+         * Commands written to the socket whose reply has not been collected
+         * yet. @n
+         * Replies come back in order, so this is a FIFO.
+         * @see Submit
+         * @see Complete
+         */
+        std::deque<InFlight> in_flight;
+
+        /**
+         * Next ticket handed out by Submit.
+         * @see Submit
+         */
+        uint64_t next_ticket = 1;
+
+        /**
+         * Bytes read past the end of a reply. @n
+         * Only happens when multiple replies are in flight, in which case
+         * they belong to the next one.
+         */
+        std::vector<char> read_ahead;
+
+#if defined(__linux__) || defined(DOXYGEN)
+        /**
+         * Shared memory negotiated with the emulator. @n
+         * When set, messages go through it instead of the socket, which is
+         * only kept around to notice the emulator going away.
+         * @see SharedMemory
+         */
+        ShmRegion *shm = nullptr;
+
+        /**
+         * io_uring instance of the connection, if any.
+         * @see IoUring
+         */
+        IoRing *uring = nullptr;
+#endif
+
+        /**
+         * When the command being exchanged has to be done by. @n
+         * Past it, reads and writes give up and the connection is closed,
+         * as we cannot know where the next reply begins anymore.
+         * @see SetTimeout
+         * @see Deadline
+         */
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::time_point::max();
+
+        /**
+         * Whether the connection was closed because of deadline.
+         */
+        bool timed_out = false;
+
+        /**
+         * When to try connecting again, after a failed attempt or a
+         * timeout.
+         * @see RECONNECT_MIN_DELAY
+         */
+        std::chrono::steady_clock::time_point retry_at{};
+
+        /**
+         * Delay before the next connection attempt, should it fail.
+         * @see RECONNECT_MIN_DELAY
+         */
+        std::chrono::milliseconds backoff{ RECONNECT_MIN_DELAY };
+
+        /**
+         * Connection Initializer.
+         * @param buffers Whether to allocate the buffers used to build and
+         * exchange IPC messages. Connections only exchanging batches built
+         * elsewhere can do without them.
+         */
+        Connection(bool buffers = true) {
+            if (!buffers)
+                return;
+            // we allocate once buffers to not have to do mallocs for each IPC
+            // request, as malloc is expansive when we optimize for µs.
+            ret_buffer = new char[MAX_IPC_RETURN_SIZE];
+            ipc_buffer = new char[MAX_IPC_SIZE];
+            batch_arg_place = new unsigned int[MAX_BATCH_REPLY_COUNT];
+        }
+
+        ~Connection() {
+            if (sock_state) {
+                close_portable(sock);
+            }
+#ifdef __linux__
+            if (shm)
+                munmap(shm, sizeof(ShmRegion));
+            delete uring;
+#endif
+            delete[] ret_buffer;
+            delete[] ipc_buffer;
+            delete[] batch_arg_place;
+        }
+
+        Connection(const Connection &rhs) = delete;
+        Connection &operator=(const Connection &rhs) = delete;
+    };
+
+    /**
+     * Session option flags this session was created with.
+     * @see SessionFlags
+     */
+    unsigned int flags = DefaultSession;
+
+    /**
+     * How long, in ms, commands of this session can take, -1 for forever.
+     * @see SetTimeout
+     */
+    std::atomic<int> timeout = -1;
+
+    /**
+     * Connection used when ConnectionPool is not set.
+     * @see Conn
+     */
+    Connection *connection = nullptr;
+
+    /**
+     * Per-thread connections used when ConnectionPool is set.
+     * @see Conn
+     */
+    std::unordered_map<std::thread::id, std::unique_ptr<Connection>> pool;
+
+    /**
+     * Protects pool from concurrent insertions.
+     * @see pool
+     */
+    std::mutex pool_blocking;
+
+    /**
+     * Unique identifier of this session. @n
+     * Used to tag per-thread caches, as the address of a destroyed session
+     * can be reused by a new one.
+     */
+    uint64_t session_id;
+
+    /**
+     * Next session identifier to hand out.
+     * @see session_id
+     */
+    static inline std::atomic<uint64_t> next_session_id{ 1 };
+
+    /**
+     * Sessions with pooled connections alive, by identifier.
+     * @see PooledConnections
+     */
+    static inline std::unordered_map<uint64_t, Shared *> pooled_sessions;
+
+    /**
+     * Protects pooled_sessions, and keeps the sessions in it alive while
+     * held.
+     */
+    static inline std::mutex pooled_sessions_blocking;
+
+    /**
+     * Sessions the calling thread has a pooled connection in. @n
+     * Releases them when the thread exits, so that workers do not have to
+     * release them by hand, and no later thread reusing their identifier
+     * inherits them in whatever state they were left in.
+     * @see ReleaseConnection
      */
-    unsigned int *batch_arg_place;
+    struct PooledConnections {
+        std::vector<uint64_t> sessions; /**< Identifiers of the sessions. */
+
+        ~PooledConnections() {
+            std::lock_guard<std::mutex> lock(pooled_sessions_blocking);
+            for (uint64_t id : sessions) {
+                auto it = pooled_sessions.find(id);
+                if (it != pooled_sessions.end())
+                    it->second->ReleaseConnection();
+            }
+        }
+    };
+    static inline thread_local PooledConnections pooled_connections;
 
     /**
-     * Sets the state of the batch command building. @n
-     * This is used when chaining multiple IPC commands in one go. @n
-     * As we cannot build multiple batch IPC commands at the same time because
-     * of state keeping issues we block the initialization of another batch
-     * request until the other ends.
+     * Per-thread cache of the last pooled connection used. @n
+     * Avoids a lookup in the pool, behind a mutex, on every IPC message.
+     * @see pool
      */
-    std::mutex batch_blocking;
+    struct ConnectionCache {
+        uint64_t session_id; /**< Session owning conn, 0 if none. */
+        Connection *conn;    /**< Last used connection. */
+    };
+    static inline thread_local ConnectionCache conn_cache;
 
     /**
-     * Sets the state of the IPC message building. @n
-     * As we cannot build multiple batch IPC commands at the same time because
-     * of state keeping issues we block the initialization of another message
-     * request until the other ends.
+     * Returns the connection the calling thread should use. @n
+     * When ConnectionPool is set, the first call of each thread creates its
+     * own connection, sockets and buffers included.
+     * @see Connection
+     * @see SessionFlags
      */
-    std::mutex ipc_blocking;
+    auto Conn() -> Connection & {
+        if (!(flags & ConnectionPool))
+            return *connection;
+        if (conn_cache.session_id == session_id)
+            return *conn_cache.conn;
+
+        std::lock_guard<std::mutex> lock(pool_blocking);
+        auto &conn = pool[std::this_thread::get_id()];
+        if (!conn) {
+            conn = std::make_unique<Connection>();
+            InitSocket(*conn);
+            std::vector<uint64_t> &sessions = pooled_connections.sessions;
+            if (std::find(sessions.begin(), sessions.end(), session_id) ==
+                sessions.end())
+                sessions.push_back(session_id);
+        }
+        conn_cache = ConnectionCache{ session_id, conn.get() };
+        return *conn;
+    }
 
     /**
      * IPC result codes. @n
@@ -230,6 +811,7 @@ class Shared {
      */
     enum IPCResult : unsigned char {
         IPC_OK = 0,     /**< IPC command successfully completed. */
+        IPC_EVENT = 1,  /**< Event pushed by the emulator. */
         IPC_FAIL = 0xFF /**< IPC command failed to complete. */
     };
 
@@ -258,29 +840,97 @@ class Shared {
     }
 
     /**
-     * Ensures a batch IPC message isn't too big.
+     * Moves the frame of the batch being built out of the way to start a new
+     * one.
+     * @param c The connection building the batch.
+     * @see Connection::spilled_batch
+     */
+    auto SpillFrame(Connection &c) -> void {
+        ToArray<uint32_t>(c.ipc_buffer, c.batch_len, 0);
+        c.spilled_batch.insert(c.spilled_batch.end(), c.ipc_buffer,
+                               c.ipc_buffer + c.batch_len);
+        // the VLE flag of string replies is kept as is by the addition.
+        for (unsigned int i = 0; i < c.arg_cnt; i++)
+            c.spilled_arg_place.push_back(c.batch_arg_place[i] +
+                                          c.spilled_reply_len);
+        c.spilled_reply_len += c.reply_len;
+        c.spilled_frames += 1;
+        c.batch_len = 4;
+        c.reply_len = 5;
+        c.arg_cnt = 0;
+    }
+
+    /**
+     * Ensures a batch IPC message isn't too big. @n
+     * If the command does not fit in the current frame of the batch, a new
+     * frame is started for it.
+     * @param c The connection building the batch.
      * @param command_size Additional size required for the message.
      * @param reply_size Additional size required for the reply.
+     * @return true if the command is too big to fit even in an empty frame.
+     * @see SpillFrame
      */
-    auto BatchSafetyChecks(int command_size, int reply_size = 0) -> bool {
+    auto BatchSafetyChecks(Connection &c, int command_size,
+                           int reply_size = 0) -> bool {
+        auto too_big = [&]() {
+            return ((c.batch_len + command_size) >= MAX_IPC_SIZE ||
+                    (c.reply_len + reply_size) >= MAX_IPC_RETURN_SIZE ||
+                    c.arg_cnt + 1 >= MAX_BATCH_REPLY_COUNT);
+        };
         // we do not really care about wasting cycles when building batch
         // packets, so let's just do sanity checks for the sake of it.
         // TODO: go back when clang has implemented C++20 [[unlikely]]
-        return ((batch_len + command_size) >= MAX_IPC_SIZE ||
-                (reply_len + reply_size) >= MAX_IPC_RETURN_SIZE ||
-                arg_cnt + 1 >= MAX_BATCH_REPLY_COUNT);
+        if (!too_big())
+            return false;
+        if (c.arg_cnt == 0)
+            return true;
+        SpillFrame(c);
+        return too_big();
+    }
+
+    /**
+     * Delays the next connection attempt of a connection, exponentially.
+     * @param c The connection.
+     * @see RECONNECT_MIN_DELAY
+     */
+    static auto Backoff(Connection &c) -> void {
+        c.retry_at = std::chrono::steady_clock::now() + c.backoff;
+        c.backoff = std::min(c.backoff * 2,
+                             std::chrono::milliseconds(RECONNECT_MAX_DELAY));
+    }
+
+    /**
+     * Returns how long, in ms and rounded up, a connection can still wait
+     * for the emulator.
+     * @param c The connection.
+     * @return The time left, -1 if there is no deadline.
+     * @see Connection::deadline
+     */
+    static auto Remaining(const Connection &c) -> int {
+        if (c.deadline == std::chrono::steady_clock::time_point::max())
+            return -1;
+        auto left = c.deadline - std::chrono::steady_clock::now();
+        if (left <= left.zero())
+            return 0;
+        return std::chrono::ceil<std::chrono::milliseconds>(left).count();
     }
 
     /**
      * Initializes the socket IPC connection with the server. @n
-     * @see sock
-     * @see sock_state
+     * @param c The connection to initialize.
+     * @param allow_shm Whether to negotiate shared memory, if the session
+     * asked for it.
+     * @see Connection::sock
+     * @see Connection::sock_state
      */
-    auto InitSocket() -> void {
+    auto InitSocket(Connection &c, bool allow_shm = true) -> void {
+        // fail fast while the emulator is away
+        if (std::chrono::steady_clock::now() < c.retry_at)
+            return;
 #ifdef _WIN32
         struct sockaddr_in server;
 
-        sock = socket(AF_INET, SOCK_STREAM, 0);
+        c.sock = socket(AF_INET, SOCK_STREAM, 0);
 
         // Prepare the sockaddr_in structure
         server.sin_family = AF_INET;
@@ -288,34 +938,164 @@ class Shared {
         server.sin_addr.s_addr = inet_addr("127.0.0.1");
         server.sin_port = htons(slot);
 
-        if (connect(sock, (struct sockaddr *)&server, sizeof(server)) < 0) {
-            close_portable(sock);
-            sock_state = false;
+        if (connect(c.sock, (struct sockaddr *)&server, sizeof(server)) < 0) {
+            close_portable(c.sock);
+            c.sock = invalid_socket_portable;
+            c.sock_state = false;
+            Backoff(c);
             return;
         }
 
+        // send blocks until everything is sent otherwise, which deadlocks
+        // with the emulator once both directions are full, and ignores
+        // deadlines: writes and reads poll the socket when it would block
+        u_long nonblocking = 1;
+        ioctlsocket(c.sock, FIONBIO, &nonblocking);
 #else
         struct sockaddr_un server;
 
-        sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        c.sock = socket(AF_UNIX, SOCK_STREAM, 0);
         server.sun_family = AF_UNIX;
-        strncpy(server.sun_path, SOCKET_NAME.c_str(), sizeof(server.sun_path));
+        const std::string &path = c.path.empty() ? SOCKET_NAME : c.path;
+        strncpy(server.sun_path, path.c_str(), sizeof(server.sun_path));
         server.sun_path[sizeof(server.sun_path) - 1] = '\0';
 
-        if (connect(sock, (struct sockaddr *)&server,
+        if (connect(c.sock, (struct sockaddr *)&server,
                     sizeof(struct sockaddr_un)) < 0) {
-            close_portable(sock);
-            sock_state = false;
+            close_portable(c.sock);
+            c.sock = invalid_socket_portable;
+            c.sock_state = false;
+            Backoff(c);
             return;
         }
 #endif
-        sock_state = true;
+        c.sock_state = true;
+        c.backoff = std::chrono::milliseconds(RECONNECT_MIN_DELAY);
 
 #ifdef __APPLE__
         int nosigpipe = 1;
-        setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &nosigpipe,
+        setsockopt(c.sock, SOL_SOCKET, SO_NOSIGPIPE, &nosigpipe,
                    sizeof(nosigpipe));
 #endif
+#ifdef __linux__
+        if ((flags & SharedMemory) && allow_shm)
+            InitSharedMemory(c);
+        // the ring outlives reconnections, as does the buffer it registered
+        if ((flags & IoUring) && !c.shm && !c.uring)
+            c.uring = IoRing::Create(c.ret_buffer);
+#endif
+    }
+
+#if defined(__linux__) || defined(DOXYGEN)
+    /**
+     * Negotiates a shared memory transport with the emulator. @n
+     * The region is created here and its file descriptor handed over the
+     * socket along with a MsgSharedMemory request. Emulators not supporting
+     * it fail the request, in which case we simply stay on the socket.
+     * @param c The connection to negotiate for, already connected.
+     * @see ShmRegion
+     */
+    auto InitSharedMemory(Connection &c) -> void {
+        int fd = memfd_create("pine", MFD_CLOEXEC);
+        if (fd < 0)
+            return;
+        void *region = MAP_FAILED;
+        if (ftruncate(fd, sizeof(ShmRegion)) == 0)
+            region = mmap(nullptr, sizeof(ShmRegion), PROT_READ | PROT_WRITE,
+                          MAP_SHARED, fd, 0);
+        if (region == MAP_FAILED) {
+            close(fd);
+            return;
+        }
+        // a new memfd is zero filled, which is a pair of empty rings.
+        ShmRegion *shm = (ShmRegion *)region;
+        shm->magic = SHM_MAGIC;
+
+        char msg[5];
+        ToArray<uint32_t>(msg, 5, 0);
+        msg[4] = MsgSharedMemory;
+        struct iovec iov = { msg, sizeof(msg) };
+        char control[CMSG_SPACE(sizeof(int))] = {};
+        struct msghdr hdr = {};
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+        bool sent = sendmsg(c.sock, &hdr, MSG_NOSIGNAL) == sizeof(msg);
+        // the emulator got its own copy of it if it cares.
+        close(fd);
+
+        IPCBuffer ret = IPCBuffer{ 4 + 1, c.ret_buffer };
+        if (!sent)
+            CloseSocket(c);
+        else if (ReadReply(c, ret) == Success) {
+            c.shm = shm;
+            return;
+        }
+        munmap(region, sizeof(ShmRegion));
+    }
+
+    /**
+     * Checks whether the emulator is still on the other end of the socket
+     * of a connection, without blocking.
+     * @param c The connection to check.
+     */
+    auto Alive(Connection &c) -> bool {
+        char byte;
+        auto peek = recv(c.sock, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        return peek > 0 || (peek < 0 && would_block_portable());
+    }
+#endif
+
+    /**
+     * Reads bytes sent by the emulator on a connection, waiting for at least
+     * one of them, or for its deadline.
+     * @param c The connection to read from.
+     * @param dst Where to store them.
+     * @param len The maximum number of bytes to read.
+     * @return The number of bytes read, 0 or less if the connection is lost.
+     */
+    auto Receive(Connection &c, char *dst, int len) -> long {
+#ifdef __linux__
+        if (c.shm) {
+            ShmRing &ring = c.shm->reply;
+            while (true) {
+                uint32_t got = ring.Pop(dst, len);
+                if (got > 0)
+                    return got;
+                int wait = Remaining(c);
+                if (wait == 0) {
+                    c.timed_out = true;
+                    return 0;
+                }
+                if (wait < 0 || wait > SHM_TIMEOUT)
+                    wait = SHM_TIMEOUT;
+                if (!ring.Wait(ring.head, ring.tail.load(), wait) &&
+                    !Alive(c))
+                    return 0;
+            }
+        }
+#endif
+        int wait = Remaining(c);
+#ifdef _WIN32
+        // the socket is non-blocking, see InitSocket
+        constexpr bool wait_first = true;
+#else
+        constexpr bool wait_first = false;
+#endif
+        if (wait >= 0 || wait_first) {
+            struct pollfd fd = { c.sock, POLLIN, 0 };
+            if (poll_portable(&fd, 1, wait) == 0) {
+                c.timed_out = true;
+                return 0;
+            }
+        }
+        return read_portable(c.sock, dst, len);
     }
 
   public:
@@ -326,23 +1106,36 @@ class Shared {
      * byte sent by the IPC to differentiate between commands.
      */
     enum IPCCommand : unsigned char {
-        MsgRead8 = 0,           /**< Read 8 bit value to memory. */
-        MsgRead16 = 1,          /**< Read 16 bit value to memory. */
-        MsgRead32 = 2,          /**< Read 32 bit value to memory. */
-        MsgRead64 = 3,          /**< Read 64 bit value to memory. */
-        MsgWrite8 = 4,          /**< Write 8 bit value to memory. */
-        MsgWrite16 = 5,         /**< Write 16 bit value to memory. */
-        MsgWrite32 = 6,         /**< Write 32 bit value to memory. */
-        MsgWrite64 = 7,         /**< Write 64 bit value to memory. */
-        MsgVersion = 8,         /**< Returns the emulator version. */
-        MsgSaveState = 9,       /**< Saves a savestate. */
-        MsgLoadState = 0xA,     /**< Loads a savestate. */
-        MsgTitle = 0xB,         /**< Returns the game title. */
-        MsgID = 0xC,            /**< Returns the game ID. */
-        MsgUUID = 0xD,          /**< Returns the game UUID. */
-        MsgGameVersion = 0xE,   /**< Returns the game verion. */
-        MsgStatus = 0xF,        /**< Returns the emulator status. */
-        MsgUnimplemented = 0xFF /**< Unimplemented IPC message. */
+        MsgRead8 = 0,               /**< Read 8 bit value to memory. */
+        MsgRead16 = 1,              /**< Read 16 bit value to memory. */
+        MsgRead32 = 2,              /**< Read 32 bit value to memory. */
+        MsgRead64 = 3,              /**< Read 64 bit value to memory. */
+        MsgWrite8 = 4,              /**< Write 8 bit value to memory. */
+        MsgWrite16 = 5,             /**< Write 16 bit value to memory. */
+        MsgWrite32 = 6,             /**< Write 32 bit value to memory. */
+        MsgWrite64 = 7,             /**< Write 64 bit value to memory. */
+        MsgVersion = 8,             /**< Returns the emulator version. */
+        MsgSaveState = 9,           /**< Saves a savestate. */
+        MsgLoadState = 0xA,         /**< Loads a savestate. */
+        MsgTitle = 0xB,             /**< Returns the game title. */
+        MsgID = 0xC,                /**< Returns the game ID. */
+        MsgUUID = 0xD,              /**< Returns the game UUID. */
+        MsgGameVersion = 0xE,       /**< Returns the game verion. */
+        MsgStatus = 0xF,            /**< Returns the emulator status. */
+        MsgReadRange = 0x10,        /**< Read a contiguous memory block. */
+        MsgWriteRange = 0x11,       /**< Write a contiguous memory block. */
+        MsgSharedMemory = 0x12,     /**< Switch to a shared memory transport. */
+        MsgSubscribe = 0x13,        /**< Switch to an event connection. */
+        MsgWatch = 0x14,            /**< Watch a memory block for changes. */
+        MsgUnwatch = 0x15,          /**< Stop watching a memory block. */
+        MsgFrameEnd = 0x16,         /**< Wait for the end of the frame. */
+        MsgReadPointerChain = 0x17, /**< Read a value behind pointers. */
+        MsgModify8 = 0x18,          /**< Modify 8 bit value in memory. */
+        MsgModify16 = 0x19,         /**< Modify 16 bit value in memory. */
+        MsgModify32 = 0x1A,         /**< Modify 32 bit value in memory. */
+        MsgModify64 = 0x1B,         /**< Modify 64 bit value in memory. */
+        MsgIf = 0x1C,               /**< Skip commands on a condition. */
+        MsgUnimplemented = 0xFF     /**< Unimplemented IPC message. */
     };
 
     /**
@@ -355,6 +1148,48 @@ class Shared {
         Shutdown = 2, /**< Game is shutdown */
     };
 
+    /**
+     * Memory modification enum. @n
+     * The operations a MsgModify command applies to a value in memory.
+     * @see Modify
+     */
+    enum ModifyOp : unsigned char {
+        Add = 0,  /**< Adds to the value, wrapping around. */
+        Sub = 1,  /**< Subtracts from the value, wrapping around. */
+        And = 2,  /**< Bitwise ands the value. */
+        Or = 3,   /**< Bitwise ors the value, setting bits. */
+        Xor = 4,  /**< Bitwise xors the value, toggling bits. */
+        Clear = 5 /**< Clears the bits of the value set in the operand. */
+    };
+
+    /**
+     * Condition enum. @n
+     * The comparisons a MsgIf command can make between a value in memory
+     * and its operand, as unsigned integers.
+     * @see BeginIf
+     */
+    enum Condition : unsigned char {
+        Equal = 0,       /**< The value is equal to the operand. */
+        NotEqual = 1,    /**< The value is not equal to the operand. */
+        Less = 2,        /**< The value is less than the operand. */
+        Greater = 3,     /**< The value is greater than the operand. */
+        LessEqual = 4,   /**< The value is at most the operand. */
+        GreaterEqual = 5 /**< The value is at least the operand. */
+    };
+
+    /**
+     * Session option flags. @n
+     * A session is bound to the slot of one emulator instance, the flags
+     * change how it is shared across threads.
+     */
+    enum SessionFlags : unsigned int {
+        DefaultSession = 0, /**< One connection shared by all threads. */
+        ConnectionPool = 1, /**< One connection per calling thread. */
+        SharedMemory = 2,   /**< Use shared memory if supported (Linux). */
+        IoUring = 4,        /**< Use io_uring if supported (Linux). */
+        LazyConnect = 8     /**< Connect on first use, not on creation. */
+    };
+
   protected:
     /**
      * Internal function for savestate IPC messages. @n
@@ -370,28 +1205,31 @@ class Shared {
      */
     template <IPCCommand Y, bool T = false>
     auto EmuState(uint8_t slot) {
+        Connection &c = Conn();
         // easiest way to get tag into a constexpr is a lambda, necessary for
         // GetReply
         // batch mode
         if constexpr (T) {
-            if (BatchSafetyChecks(2)) {
+            if (BatchSafetyChecks(c, 2)) {
                 SetError(OutOfMemory);
                 return (char *)0;
             }
-            char *cmd = &ipc_buffer[batch_len];
+            char *cmd = &c.ipc_buffer[c.batch_len];
             cmd[0] = Y;
             cmd[1] = slot;
-            batch_len += 2;
-            arg_cnt += 1;
+            c.batch_len += 2;
+            // no reply, but relocation still walks over every argument.
+            c.batch_arg_place[c.arg_cnt] = c.reply_len;
+            c.arg_cnt += 1;
             return cmd;
         } else {
             // we are already locked in batch mode
-            std::lock_guard<std::mutex> lock(ipc_blocking);
-            ToArray(ipc_buffer, 4 + 2, 0);
-            ipc_buffer[4] = Y;
-            ipc_buffer[5] = slot;
-            SendCommand(IPCBuffer{ 4 + 1 + 1, ipc_buffer },
-                        IPCBuffer{ 4 + 1, ret_buffer });
+            std::lock_guard<std::mutex> lock(c.ipc_blocking);
+            ToArray(c.ipc_buffer, 4 + 2, 0);
+            c.ipc_buffer[4] = Y;
+            c.ipc_buffer[5] = slot;
+            SendCommand(c, IPCBuffer{ 4 + 1 + 1, c.ipc_buffer },
+                        IPCBuffer{ 4 + 1, c.ret_buffer });
             return;
         }
     }
@@ -411,32 +1249,66 @@ class Shared {
      */
     template <IPCCommand Y, bool T = false>
     auto StringCommands() {
+        Connection &c = Conn();
         // batch mode
         if constexpr (T) {
-            // reply is automatically set to max because of reloc, so let's not
-            // check that
-            if (BatchSafetyChecks(1, 4)) {
+            // the reply is only known to fit once received, so we can only
+            // check its size field
+            if (BatchSafetyChecks(c, 1, 4)) {
                 SetError(OutOfMemory);
                 return (char *)0;
             }
-            char *cmd = &ipc_buffer[batch_len];
+            char *cmd = &c.ipc_buffer[c.batch_len];
             cmd[0] = Y;
-            batch_len += 1;
+            c.batch_len += 1;
             // MSB is used as a flag to warn pine that the reply is a VLE!
-            batch_arg_place[arg_cnt] = (reply_len | 0x80000000);
-            reply_len += 4;
-            needs_reloc = true;
-            arg_cnt += 1;
+            c.batch_arg_place[c.arg_cnt] = (c.reply_len | 0x80000000);
+            c.reply_len += 4;
+            c.needs_reloc = true;
+            c.arg_cnt += 1;
             return cmd;
         } else {
             // we are already locked in batch mode
-            std::lock_guard<std::mutex> lock(ipc_blocking);
-            ToArray(ipc_buffer, 4 + 1, 0);
-            ipc_buffer[4] = Y;
-            SendCommand(IPCBuffer{ 4 + 1, ipc_buffer },
-                        IPCBuffer{ MAX_IPC_RETURN_SIZE, ret_buffer });
-            return GetReply<Y>(ret_buffer, 5);
+            std::lock_guard<std::mutex> lock(c.ipc_blocking);
+            ToArray(c.ipc_buffer, 4 + 1, 0);
+            c.ipc_buffer[4] = Y;
+            SendCommand(c, IPCBuffer{ 4 + 1, c.ipc_buffer },
+                        IPCBuffer{ MAX_IPC_RETURN_SIZE, c.ret_buffer });
+            return GetReply<Y>(c.ret_buffer, 5);
+        }
+    }
+
+    /**
+     * Internal function for IPC messages returning strings into a caller
+     * provided buffer. @n
+     * On error throws an IPCStatus. @n
+     * The string is truncated to fit and always NUL terminated, nothing is
+     * allocated.
+     * @see StringCommands
+     * @param dst The buffer to copy the string into.
+     * @param size The size of dst.
+     * @param Y IPCCommand to use.
+     * @return The length of the whole string, which was truncated if it is
+     * bigger than or equal to size.
+     */
+    template <IPCCommand Y>
+    auto StringCommands(char *dst, size_t size) -> size_t {
+        Connection &c = Conn();
+        if (size > 0)
+            dst[0] = '\0';
+        std::lock_guard<std::mutex> lock(c.ipc_blocking);
+        ToArray(c.ipc_buffer, 4 + 1, 0);
+        c.ipc_buffer[4] = Y;
+        if (!SendCommand(c, IPCBuffer{ 4 + 1, c.ipc_buffer },
+                         IPCBuffer{ MAX_IPC_RETURN_SIZE, c.ret_buffer }))
+            return 0;
+        std::string_view reply = GetReplyView<Y>(c.ret_buffer, 5);
+        if (size > 0) {
+            size_t copied = std::min(reply.size(), size - 1);
+            memcpy(dst, reply.data(), copied);
+            dst[copied] = '\0';
         }
+        return reply.size();
     }
 
   public:
@@ -459,24 +1331,62 @@ class Shared {
      */
     struct BatchCommand {
         IPCBuffer ipc_message;          /**< IPC message fields. */
-        IPCBuffer ipc_return;           /**< IPC return fields. */
+        mutable IPCBuffer ipc_return;   /**< IPC return fields, grown upon
+                                           receiving variable length replies. */
         unsigned int *return_locations; /**< Location of arguments in IPC return
                                            fields. */
         unsigned int msg_size;          /**< Number of IPC messages. */
         bool reloc; /**< Whether the message needs relocation. */
+        unsigned int *reloc_locations; /**< Location of arguments before
+                                          relocation, if needed. */
+        unsigned int frames; /**< Number of IPC messages it is split into. */
 
         BatchCommand()
             : ipc_message{}, ipc_return{}, return_locations(nullptr),
-              msg_size(0), reloc(false) {}
+              msg_size(0), reloc(false), reloc_locations(nullptr), frames(0) {}
 
         BatchCommand(IPCBuffer message, IPCBuffer ret, unsigned int *locations,
-                     unsigned int size, bool r)
+                     unsigned int size, bool r, unsigned int f = 1)
             : ipc_message(message), ipc_return(ret),
-              return_locations(locations), msg_size(size), reloc(r) {}
+              return_locations(locations), msg_size(size), reloc(r),
+              reloc_locations(nullptr), frames(f) {
+            // relocation is redone from scratch on every send, so that the
+            // same batch can be sent over and over again.
+            if (reloc) {
+                reloc_locations = new unsigned int[msg_size];
+                memcpy(reloc_locations, return_locations,
+                       msg_size * sizeof(unsigned int));
+            }
+        }
 
         BatchCommand(const BatchCommand &rhs) = delete;
         BatchCommand &operator=(const BatchCommand &rhs) = delete;
 
+        /**
+         * Copies the batch command, buffers included. @n
+         * Lets the same batch be sent to multiple emulators, each copy
+         * receiving the replies of one of them.
+         * @param message Whether to copy the IPC message, replies alone can
+         * be received without it.
+         * @return The copy.
+         */
+        auto Clone(bool message = true) const -> BatchCommand {
+            BatchCommand clone;
+            if (message)
+                clone.ipc_message =
+                    IPCBuffer{ ipc_message.size,
+                               Copy(ipc_message.buffer, ipc_message.size) };
+            clone.ipc_return = IPCBuffer{
+                ipc_return.size, Copy(ipc_return.buffer, ipc_return.size)
+            };
+            clone.return_locations = Copy(return_locations, msg_size);
+            clone.msg_size = msg_size;
+            clone.reloc = reloc;
+            clone.reloc_locations = Copy(reloc_locations, msg_size);
+            clone.frames = frames;
+            return clone;
+        }
+
         BatchCommand(BatchCommand &&rhs) { MoveFrom(rhs); }
         BatchCommand &operator=(BatchCommand &&rhs) {
             Cleanup();
@@ -487,26 +1397,185 @@ class Shared {
         ~BatchCommand() { Cleanup(); }
 
       private:
+        template <typename T>
+        static auto Copy(const T *src, size_t count) -> T * {
+            if (!src)
+                return nullptr;
+            T *dst = new T[count];
+            memcpy(dst, src, count * sizeof(T));
+            return dst;
+        }
+
         void MoveFrom(BatchCommand &rhs) {
             ipc_message = rhs.ipc_message;
             ipc_return = rhs.ipc_return;
             return_locations = rhs.return_locations;
             msg_size = rhs.msg_size;
             reloc = rhs.reloc;
+            reloc_locations = rhs.reloc_locations;
+            frames = rhs.frames;
 
             rhs.ipc_message = IPCBuffer{};
             rhs.ipc_return = IPCBuffer{};
             rhs.return_locations = nullptr;
             rhs.msg_size = 0;
             rhs.reloc = false;
+            rhs.reloc_locations = nullptr;
+            rhs.frames = 0;
         }
 
         void Cleanup() {
             delete[] ipc_message.buffer;
             delete[] ipc_return.buffer;
             delete[] return_locations;
+            delete[] reloc_locations;
+        }
+    };
+
+    /**
+     * Location of a value inside of a batch command. @n
+     * Returned by batched writes to patch the value they write in place,
+     * without having to rebuild the batch.
+     * @see Write
+     * @see Patch
+     */
+    template <typename Y>
+    struct BatchSlot {
+        unsigned int offset; /**< Offset of the value in the IPC message. */
+    };
+
+    /**
+     * Changes the value written by a batched write. @n
+     * The batch can then be sent again as is: this neither allocates nor
+     * needs any lock, but the batch must not be in flight while patched.
+     * @param cmd The batch command to patch.
+     * @param slot The slot returned by the write when building the batch.
+     * @param value The new value to write.
+     * @see BatchSlot
+     * @see Write
+     */
+    template <typename Y>
+    static auto Patch(BatchCommand &cmd, BatchSlot<Y> slot, Y value) -> void {
+        ToArray<Y>(cmd.ipc_message.buffer, value, slot.offset);
+    }
+
+    /**
+     * Change of a watched memory block, pushed by the emulator.
+     * @see Watch
+     * @see NextEvent
+     */
+    struct WatchEvent {
+        uint32_t id;            /**< Watch identifier, returned by Watch. */
+        uint32_t address;       /**< Address of the memory block. */
+        std::vector<char> data; /**< New contents of the memory block. */
+    };
+
+#if defined(__linux__) || defined(DOXYGEN)
+    /**
+     * Single producer, single consumer byte ring living in shared memory. @n
+     * The exact same bytes that would go through the socket go through it,
+     * framing included. Both sides spin for a little while before sleeping
+     * on a futex, and only issue a wake-up syscall when the other one sleeps.
+     * @see ShmRegion
+     */
+    struct ShmRing {
+        std::atomic<uint32_t> head;     /**< Bytes written by the producer. */
+        std::atomic<uint32_t> tail;     /**< Bytes read by the consumer. */
+        std::atomic<uint32_t> sleeping; /**< Sides sleeping on head or tail. */
+        char data[SHM_RING_SIZE];       /**< Ring contents. */
+
+        static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) &&
+                          std::atomic<uint32_t>::is_always_lock_free,
+                      "futexes need plain 32 bit atomics");
+
+        /**
+         * Writes as many bytes as there is room for. Producer side.
+         * @param src The bytes to write.
+         * @param len The number of bytes to write.
+         * @return The number of bytes written.
+         */
+        auto Push(const char *src, uint32_t len) -> uint32_t {
+            uint32_t h = head.load(std::memory_order_relaxed);
+            uint32_t room = SHM_RING_SIZE - (h - tail.load());
+            uint32_t n = std::min(len, room);
+            uint32_t at = h % SHM_RING_SIZE;
+            uint32_t first = std::min<uint32_t>(n, SHM_RING_SIZE - at);
+            memcpy(&data[at], src, first);
+            memcpy(data, &src[first], n - first);
+            head.store(h + n);
+            if (n > 0 && sleeping.load() > 0)
+                Wake(head);
+            return n;
+        }
+
+        /**
+         * Reads as many bytes as available. Consumer side.
+         * @param dst Where to store the bytes.
+         * @param len The maximum number of bytes to read.
+         * @return The number of bytes read.
+         */
+        auto Pop(char *dst, uint32_t len) -> uint32_t {
+            uint32_t t = tail.load(std::memory_order_relaxed);
+            uint32_t n = std::min(len, head.load() - t);
+            uint32_t at = t % SHM_RING_SIZE;
+            uint32_t first = std::min<uint32_t>(n, SHM_RING_SIZE - at);
+            memcpy(dst, &data[at], first);
+            memcpy(&dst[first], data, n - first);
+            tail.store(t + n);
+            if (n > 0 && sleeping.load() > 0)
+                Wake(tail);
+            return n;
+        }
+
+        /**
+         * Waits for head or tail to move away from a value it had. @n
+         * The consumer waits on head for bytes to read, the producer on tail
+         * for room to write.
+         * @param word head or tail.
+         * @param seen The value it had.
+         * @param timeout_ms How long to sleep for at most.
+         * @return false if it timed out without moving.
+         */
+        auto Wait(std::atomic<uint32_t> &word, uint32_t seen, int timeout_ms)
+            -> bool {
+            // replies of a running emulator come back within µs, spinning
+            // saves us two syscalls and a context switch. With a single core
+            // it would only delay the other side though.
+            static const int spins =
+                std::thread::hardware_concurrency() > 1 ? 4096 : 0;
+            for (int i = 0; i < spins; i++) {
+                if (word.load(std::memory_order_acquire) != seen)
+                    return true;
+            }
+            struct timespec timeout = { timeout_ms / 1000,
+                                        (timeout_ms % 1000) * 1000000 };
+            sleeping.fetch_add(1);
+            if (word.load() == seen)
+                syscall(SYS_futex, (uint32_t *)&word, FUTEX_WAIT, seen,
+                        &timeout, nullptr, 0);
+            sleeping.fetch_sub(1);
+            return word.load() != seen;
         }
+
+      private:
+        static auto Wake(std::atomic<uint32_t> &word) -> void {
+            syscall(SYS_futex, (uint32_t *)&word, FUTEX_WAKE, INT32_MAX,
+                    nullptr, nullptr, 0);
+        }
+    };
+
+    /**
+     * Shared memory region of the shared memory transport. @n
+     * Created by the client and handed to the emulator with
+     * MsgSharedMemory.
+     * @see SharedMemory
+     */
+    struct ShmRegion {
+        uint32_t magic;  /**< Set to SHM_MAGIC by the client. */
+        ShmRing request; /**< Messages, from the client to the emulator. */
+        ShmRing reply;   /**< Replies, from the emulator to the client. */
     };
+#endif
 
     /**
      * Result code of the IPC operation. @n
@@ -519,7 +1588,8 @@ class Shared {
         OutOfMemory = 2,   /**< IPC command too big to send. */
         NoConnection = 3,  /**< Cannot connect to the IPC socket. */
         Unimplemented = 4, /**< Unimplemented IPC command. */
-        Unknown = 5        /**< Unknown status. */
+        Unknown = 5,       /**< Unknown status. */
+        Timeout = 6        /**< IPC command did not complete in time. */
     };
 
   protected:
@@ -594,7 +1664,9 @@ class Shared {
      * @return The reply, variable type. Refer to the documentation of the
      * standard function. Ownership of datastreams is also passed down to you,
      * so don't forget to read carefully the documentation and see if you need
-     * to free anything!
+     * to free anything! @n
+     * The exception being MsgReadRange, which returns a pointer to the block
+     * inside of the reply buffer: it is yours to read, not to free.
      * @see IPCResult
      * @see IPCBuffer
      */
@@ -609,16 +1681,19 @@ class Shared {
             buf = cmd;
             loc = place;
         }
-        if constexpr (T == MsgRead8)
+        if constexpr (T == MsgRead8 || T == MsgModify8)
             return FromArray<uint8_t>(buf, loc);
-        else if constexpr (T == MsgRead16)
+        else if constexpr (T == MsgRead16 || T == MsgModify16)
             return FromArray<uint16_t>(buf, loc);
-        else if constexpr (T == MsgRead32)
+        else if constexpr (T == MsgRead32 || T == MsgModify32 ||
+                           T == MsgWatch || T == MsgFrameEnd)
             return FromArray<uint32_t>(buf, loc);
-        else if constexpr (T == MsgRead64)
+        else if constexpr (T == MsgRead64 || T == MsgModify64)
             return FromArray<uint64_t>(buf, loc);
         else if constexpr (T == MsgStatus)
             return FromArray<EmuStatus>(buf, loc);
+        else if constexpr (T == MsgReadRange)
+            return &buf[loc];
         else if constexpr (T == MsgVersion || T == MsgID || T == MsgTitle ||
                            T == MsgUUID || T == MsgGameVersion) {
             uint32_t size = FromArray<uint32_t>(buf, loc);
@@ -632,110 +1707,668 @@ class Shared {
     }
 
     /**
-     * Sends an IPC command to the emulator. @n
-     * Fails if the IPC cannot be sent or if the emulator returns IPC_FAIL.
-     * Throws an IPCStatus on failure.
-     * @param cmd An IPCBuffer containing the IPC command size and buffer OR a
+     * Returns the reply of an IPC command returning a string, without any
+     * copy. @n
+     * Works on the same replies as GetReply, but returns a view of the
+     * string inside of the reply buffer rather than a datastream you have to
+     * free. The view is valid as long as the reply buffer is and isn't
+     * overwritten, ie until the BatchCommand is sent again or destroyed.
+     * @param cmd A char array containing the IPC return buffer OR a
      * BatchCommand.
-     * @param rt An IPCBuffer containing the IPC return size and buffer.
-     * @see IPCResult
-     * @see IPCBuffer
+     * @param place An integer specifying where the argument is
+     * in the buffer OR which function to read the reply of in
+     * the case of a BatchCommand.
+     * @return The string, without its NUL terminator.
+     * @see GetReply
      */
-    template <typename T>
-    auto SendCommand(const T &cmd, const T &rt = T()) -> void {
-        IPCBuffer command;
-        IPCBuffer ret;
-
-        if constexpr (std::is_same<T, BatchCommand>::value) {
-            command = cmd.ipc_message;
-            ret = cmd.ipc_return;
+    template <IPCCommand T, typename Y>
+    auto GetReplyView(const Y &cmd, int place) -> std::string_view {
+        static_assert(T == MsgVersion || T == MsgID || T == MsgTitle ||
+                          T == MsgUUID || T == MsgGameVersion,
+                      "GetReplyView only works on string replies");
+        char *buf;
+        int loc;
+        if constexpr (std::is_same<Y, BatchCommand>::value) {
+            buf = cmd.ipc_return.buffer;
+            loc = cmd.return_locations[place];
         } else {
-            command = cmd;
-            ret = rt;
+            buf = cmd;
+            loc = place;
+        }
+        uint32_t size = FromArray<uint32_t>(buf, loc);
+        // the string is sent along with its NUL terminator
+        return std::string_view(&buf[loc + 4], strnlen(&buf[loc + 4], size));
+    }
+
+  protected:
+    /**
+     * Closes the socket of a connection. @n
+     * Every command still in flight on it is failed, as its reply will never
+     * come.
+     * @param c The connection to close.
+     */
+    auto CloseSocket(Connection &c) -> void {
+        if (c.sock_state) {
+            close_portable(c.sock);
+            c.sock_state = false;
+        }
+        // the descriptor can be reused by anything from now on
+        c.sock = invalid_socket_portable;
+        // an emulator not replying in time is likely stuck, there is no
+        // point in waiting for it again right away
+        if (c.timed_out)
+            Backoff(c);
+#ifdef __linux__
+        if (c.shm) {
+            munmap(c.shm, sizeof(ShmRegion));
+            c.shm = nullptr;
+        }
+#endif
+        c.read_ahead.clear();
+        for (auto &pending : c.in_flight) {
+            if (!pending.done) {
+                pending.done = true;
+                pending.status = NoConnection;
+            }
         }
+    }
 
-        if (!sock_state) {
-            InitSocket();
+    /**
+     * Writes an IPC message to the socket of a connection. @n
+     * Connects first if needed. @n
+     * While the socket is full, replies are read into the read-ahead buffer
+     * of the connection: the emulator could otherwise be stuck sending the
+     * reply of a message we already sent, and stop reading ours.
+     * @param c The connection to write to.
+     * @param command The IPC message, or multiple of them back to back.
+     * @return false if the message could not be written.
+     */
+    auto WriteCommand(Connection &c, const IPCBuffer &command) -> bool {
+        if (!c.sock_state) {
+            InitSocket(c);
+            // still away, eg while backing off: nothing to write to
+            if (!c.sock_state)
+                return false;
         }
 
-        if (write_portable(sock, command.buffer, command.size) < 0) {
+        int sent = 0;
+#ifdef __linux__
+        while (c.shm && sent < command.size) {
+            ShmRing &ring = c.shm->request;
+            uint32_t tail = ring.tail.load();
+            uint32_t pushed =
+                ring.Push(&command.buffer[sent], command.size - sent);
+            sent += pushed;
+            if (pushed > 0)
+                continue;
+            // same as a full socket, make room for the replies first
+            ShmRing &replies = c.shm->reply;
+            uint32_t ready = replies.head.load() - replies.tail.load();
+            if (ready > 0) {
+                size_t held = c.read_ahead.size();
+                c.read_ahead.resize(held + ready);
+                replies.Pop(&c.read_ahead[held], ready);
+            } else if (Remaining(c) == 0) {
+                c.timed_out = true;
+                CloseSocket(c);
+                return false;
+            } else if (!ring.Wait(ring.tail, tail, 1) && !Alive(c)) {
+                CloseSocket(c);
+                return false;
+            }
+        }
+#endif
+        while (sent < command.size) {
+            auto tmp_length = write_nonblock_portable(
+                c.sock, &command.buffer[sent], command.size - sent);
+            if (tmp_length >= 0) {
+                sent += tmp_length;
+                continue;
+            }
             // if our write failed, assume the socket connection cannot be
             // established
-            close_portable(sock);
-            sock_state = false;
-            SetError(NoConnection);
-            return;
+            if (!would_block_portable()) {
+                CloseSocket(c);
+                return false;
+            }
+
+            struct pollfd fd = { c.sock, POLLIN | POLLOUT, 0 };
+            int ready = poll_portable(&fd, 1, Remaining(c));
+            if (ready == 0)
+                c.timed_out = true;
+            if (ready <= 0) {
+                CloseSocket(c);
+                return false;
+            }
+            if (fd.revents & POLLIN) {
+                size_t held = c.read_ahead.size();
+                c.read_ahead.resize(held + 65536);
+                auto read_length =
+                    read_portable(c.sock, &c.read_ahead[held], 65536);
+                if (read_length <= 0) {
+                    CloseSocket(c);
+                    return false;
+                }
+                c.read_ahead.resize(held + read_length);
+            } else if (fd.revents & (POLLERR | POLLHUP)) {
+                CloseSocket(c);
+                return false;
+            }
         }
 
 #ifdef DEBUG
         printf("packet sent:\n");
         hexdump(command.buffer, command.size);
 #endif
+        return true;
+    }
 
+    /**
+     * Reads one IPC reply from the socket of a connection. @n
+     * Replies are read in the order their messages were written.
+     * @param c The connection to read from.
+     * @param ret The IPCBuffer to store the reply into.
+     * @param grow Whether ret is owned by a BatchCommand and can be
+     * reallocated to fit a reply bigger than it.
+     * @param offset Where to store the reply in ret, used by batches split
+     * in multiple IPC messages.
+     * @param received How much of the reply is already stored there.
+     * @return The status of the reply.
+     */
+    auto ReadReply(Connection &c, IPCBuffer &ret, bool grow = false,
+                   int offset = 0, int received = 0) -> IPCStatus {
         // either int or ssize_t depending on the platform, so we have to
         // use a bunch of auto
-        auto receive_length = 0;
+        auto receive_length = received;
         auto end_length = 4;
+        char *buf = &ret.buffer[offset];
+        int size = ret.size - offset;
+
+        // replies with strings cannot be sized in advance, so their buffer is
+        // only made as big as needed once we know it.
+        auto resize = [&](int new_size) {
+            char *buffer = new char[offset + new_size];
+            memcpy(buffer, ret.buffer, offset + receive_length);
+            delete[] ret.buffer;
+            ret = IPCBuffer{ offset + new_size, buffer };
+            buf = &ret.buffer[offset];
+            size = new_size;
+        };
+        // a previous reply of the batch might have grown into our space
+        if (size < end_length && grow)
+            resize(end_length);
 
         // while we haven't received the entire packet, maybe due to
         // socket datagram splittage, we continue to read
-        while (receive_length < end_length) {
-            auto tmp_length = read_portable(sock, &ret.buffer[receive_length],
-                                            ret.size - receive_length);
-            // we close the connection if an error happens
-            if (tmp_length <= 0) {
-                receive_length = 0;
-                break;
-            }
-
-            receive_length += tmp_length;
-
+        while (true) {
             // if we got at least the final size then update
             if (end_length == 4 && receive_length >= 4) {
-                end_length = FromArray<uint32_t>(ret.buffer, 0);
-                if (end_length > MAX_IPC_SIZE) {
+                end_length = FromArray<uint32_t>(buf, 0);
+                if (end_length > MAX_IPC_SIZE || end_length < 5 ||
+                    (end_length > size && !grow)) {
                     receive_length = 0;
                     break;
                 }
+                if (end_length > size)
+                    resize(end_length);
+            }
+            if (receive_length >= end_length)
+                break;
+
+            // with multiple messages in flight a previous read might have
+            // swallowed the beginning of this reply.
+            if (!c.read_ahead.empty()) {
+                int tmp_length = std::min<int>((int)c.read_ahead.size(),
+                                               size - receive_length);
+                memcpy(&buf[receive_length], c.read_ahead.data(), tmp_length);
+                c.read_ahead.erase(c.read_ahead.begin(),
+                                   c.read_ahead.begin() + tmp_length);
+                receive_length += tmp_length;
+                continue;
             }
+
+            auto tmp_length =
+                Receive(c, &buf[receive_length], size - receive_length);
+            if (tmp_length <= 0) {
+                receive_length = 0;
+                break;
+            }
+
+            receive_length += tmp_length;
         }
 #ifdef DEBUG
         printf("reply received:\n");
-        hexdump(ret.buffer, receive_length);
+        hexdump(buf, receive_length);
 #endif
+        // we close the connection if an error happens, as we cannot know
+        // where the next reply begins anymore
         if (receive_length == 0) {
-            SetError(Fail);
-            return;
+            CloseSocket(c);
+            return c.timed_out ? Timeout : Fail;
         }
 
-        if ((unsigned char)ret.buffer[4] == IPC_FAIL) {
-            SetError(Fail);
-            return;
+        // keep what belongs to the next replies
+        if (receive_length > end_length) {
+            c.read_ahead.insert(c.read_ahead.begin(), &buf[end_length],
+                                &buf[receive_length]);
         }
 
-        // batch commands are a bit more complex than you'd expect: some replies
-        // are VLE, so we need to relocate accordingly all future replies by an
-        // offset to ensure GetReply points to the correct buffer location.
+        if ((unsigned char)buf[4] == IPC_FAIL) {
+            return Fail;
+        }
+        return Success;
+    }
+
+    /**
+     * Relocates the replies of a batch command after it has been received.
+     * @n Batch commands are a bit more complex than you'd expect: some
+     * replies are VLE, so we need to relocate accordingly all future replies
+     * by an offset to ensure GetReply points to the correct buffer location.
+     * @param cmd The batch command whose reply was just received.
+     */
+    auto Relocate(const BatchCommand &cmd) -> void {
         // We can do it in an O(n) way by storing the global relocation offset
         // and applying it to all future commands in one go instead of doing it
         // in an O(n^2) and updating the list every time we encounter an offset
         // update.
         // why not just assume a standard size instead of going through the pain
         // of relocating everything in the protocol? math is cheap, io isn't.
-        if constexpr (std::is_same<T, BatchCommand>::value) {
-            if (cmd.reloc) {
-                unsigned int reloc_add = 0;
-                for (unsigned int i = 0; i < cmd.msg_size; i++) {
-                    cmd.return_locations[i] += reloc_add;
-                    if ((cmd.return_locations[i] & 0x80000000) != 0) {
-                        cmd.return_locations[i] =
-                            (cmd.return_locations[i] & ~0x80000000);
-                        reloc_add += FromArray<uint32_t>(
-                            ret.buffer, (cmd.return_locations[i]));
-                    }
+        // we always start back from the locations FinalizeBatch computed so
+        // that sending the same batch multiple times stays correct.
+        if (cmd.reloc) {
+            unsigned int reloc_add = 0;
+            for (unsigned int i = 0; i < cmd.msg_size; i++) {
+                unsigned int location = cmd.reloc_locations[i] + reloc_add;
+                if ((location & 0x80000000) != 0) {
+                    location = (location & ~0x80000000);
+                    reloc_add +=
+                        FromArray<uint32_t>(cmd.ipc_return.buffer, location);
                 }
+                cmd.return_locations[i] = location;
+            }
+        }
+    }
+
+    /**
+     * Reads the reply of a batch command, one per IPC message it is split
+     * into, and relocates it.
+     * @param c The connection to read from.
+     * @param cmd The batch command that was sent.
+     * @param received How much of the first reply is already stored in it.
+     * @return The status of the reply, that of the last of its messages that
+     * failed if any.
+     */
+    auto ReadBatchReply(Connection &c, const BatchCommand &cmd,
+                        int received = 0) -> IPCStatus {
+        IPCStatus status = Success;
+        int offset = 0;
+        // replies are stored back to back, the locations FinalizeBatch
+        // computed account for the header of each of them.
+        for (unsigned int i = 0; i < cmd.frames; i++) {
+            IPCStatus reply = ReadReply(c, cmd.ipc_return, true, offset,
+                                        i == 0 ? received : 0);
+            if (reply != Success) {
+                status = reply;
+                // we can still read the next replies as long as the
+                // connection is up
+                if (!c.sock_state)
+                    break;
             }
+            offset += FromArray<uint32_t>(cmd.ipc_return.buffer, offset);
+        }
+        if (status == Success)
+            Relocate(cmd);
+        return status;
+    }
+
+    /**
+     * Reads the reply of the oldest command in flight on a connection.
+     * @param c The connection to read from.
+     * @see Submit
+     */
+    auto CompleteOne(Connection &c) -> void {
+        for (auto &pending : c.in_flight) {
+            if (pending.done)
+                continue;
+            pending.status = ReadBatchReply(c, *pending.cmd);
+            pending.done = true;
+            return;
+        }
+    }
+
+    /**
+     * Reads the replies of all the commands in flight on a connection. @n
+     * Their status is kept around until Complete is called on them.
+     * @param c The connection to read from.
+     * @see Submit
+     */
+    auto Drain(Connection &c) -> void {
+        while (!c.in_flight.empty() && !c.in_flight.back().done)
+            CompleteOne(c);
+    }
+
+    /**
+     * Sets the deadline of the command about to be exchanged on a
+     * connection, from the timeout of the session and the Deadline of the
+     * calling thread.
+     * @param c The connection.
+     * @see Connection::deadline
+     */
+    auto Arm(Connection &c) -> void {
+        c.deadline = Deadline::current;
+        int ms = timeout.load(std::memory_order_relaxed);
+        if (ms >= 0)
+            c.deadline = std::min(c.deadline, std::chrono::steady_clock::now() +
+                                                  std::chrono::milliseconds(ms));
+        c.timed_out = false;
+    }
+
+    /**
+     * Sends an IPC command to the emulator through a given connection. @n
+     * Same as SendCommand, but expects the caller to hold the ipc_blocking
+     * lock of the connection.
+     * @param c The connection to send the command through.
+     * @param cmd An IPCBuffer containing the IPC command size and buffer OR a
+     * BatchCommand.
+     * @param rt An IPCBuffer containing the IPC return size and buffer.
+     * @return false on failure, for the C bindings to bail out.
+     * @see IPCResult
+     * @see IPCBuffer
+     */
+    template <typename T>
+    auto SendCommand(Connection &c, const T &cmd, const T &rt = T())
+        -> bool {
+        IPCBuffer command;
+        IPCBuffer ret;
+
+        if constexpr (std::is_same<T, BatchCommand>::value) {
+            command = cmd.ipc_message;
+        } else {
+            command = cmd;
+            ret = rt;
+        }
+
+        Arm(c);
+        // replies come back in order, so we have to get the ones of submitted
+        // commands out of the way first.
+        Drain(c);
+
+        int sent = 0;
+        int received = 0;
+#ifdef __linux__
+        // the emulator only replies once it read the whole message, which
+        // does not hold for batches split in multiple of them.
+        if (c.uring && c.sock_state && c.read_ahead.empty()) {
+            IPCBuffer reply = IPCBuffer{ 0, nullptr };
+            if constexpr (std::is_same<T, BatchCommand>::value) {
+                if (cmd.frames == 1)
+                    reply = cmd.ipc_return;
+            } else {
+                reply = ret;
+            }
+            if (reply.buffer)
+                sent = c.uring->Exchange(c.sock, command.buffer, command.size,
+                                         reply.buffer, reply.size, received,
+                                         Remaining(c));
+            if (c.uring->broken) {
+                delete c.uring;
+                c.uring = nullptr;
+                CloseSocket(c);
+                SetError(NoConnection);
+                return false;
+            }
+        }
+#endif
+
+        if (sent < command.size &&
+            !WriteCommand(c, IPCBuffer{ command.size - sent,
+                                        &command.buffer[sent] })) {
+            SetError(c.timed_out ? Timeout : NoConnection);
+            return false;
+        }
+
+        IPCStatus status;
+        if constexpr (std::is_same<T, BatchCommand>::value) {
+            status = ReadBatchReply(c, cmd, received);
+        } else {
+            status = ReadReply(c, ret, false, 0, received);
+        }
+        if (status != Success) {
+            SetError(status);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Event connection state. @n
+     * Events are pushed by the emulator on a connection of their own, read
+     * by a dedicated thread, so that they never get in the way of replies.
+     * @see Watch
+     */
+    struct EventStream {
+        /**
+         * Event connection, once subscribed.
+         */
+        std::unique_ptr<Connection> conn;
+
+        /**
+         * Subscriber identifier the emulator gave us.
+         */
+        uint32_t subscriber = 0;
+
+        /**
+         * Thread reading the events.
+         * @see ReadEvents
+         */
+        std::thread reader;
+
+        /**
+         * Asks reader to return.
+         */
+        std::atomic<bool> stopping{ false };
+
+        /**
+         * Serializes subscriptions.
+         * @see Subscribe
+         */
+        std::mutex subscribe_blocking;
+
+        /**
+         * Protects queue, callback and open.
+         */
+        std::mutex queue_blocking;
+
+        /**
+         * Signaled whenever queue or open change.
+         */
+        std::condition_variable queue_ready;
+
+        /**
+         * Events not consumed yet.
+         * @see NextEvent
+         */
+        std::deque<WatchEvent> queue;
+
+        /**
+         * Called with every event instead of queueing it, if set.
+         * @see OnWatch
+         */
+        std::function<void(const WatchEvent &)> callback;
+
+        /**
+         * Whether reader is still reading events.
+         */
+        bool open = false;
+    };
+
+    /**
+     * Event connection of this session.
+     * @see EventStream
+     */
+    EventStream events;
+
+    /**
+     * Opens the event connection of the session, if not done already. @n
+     * A lost event connection is opened again, the watches it had being gone
+     * along with it.
+     * @return The subscriber identifier the emulator gave us, 0 on failure.
+     * @see EventStream
+     */
+    auto Subscribe() -> uint32_t {
+        std::lock_guard<std::mutex> lock(events.subscribe_blocking);
+        {
+            std::lock_guard<std::mutex> queue_lock(events.queue_blocking);
+            if (events.open)
+                return events.subscriber;
+        }
+        if (events.reader.joinable())
+            events.reader.join();
+
+        // events are rare enough to not bother with shared memory
+        events.conn = std::make_unique<Connection>();
+        Connection &c = *events.conn;
+        InitSocket(c, false);
+        if (!c.sock_state) {
+            SetError(NoConnection);
+            return 0;
+        }
+        ToArray<uint32_t>(c.ipc_buffer, 4 + 1, 0);
+        c.ipc_buffer[4] = MsgSubscribe;
+        if (!SendCommand(c, IPCBuffer{ 4 + 1, c.ipc_buffer },
+                         IPCBuffer{ 4 + 1 + 4, c.ret_buffer }))
+            return 0;
+
+        events.subscriber = FromArray<uint32_t>(c.ret_buffer, 5);
+        events.stopping = false;
+        {
+            std::lock_guard<std::mutex> queue_lock(events.queue_blocking);
+            events.open = true;
+        }
+        events.reader = std::thread([this]() { ReadEvents(); });
+        return events.subscriber;
+    }
+
+    /**
+     * Reads events until the event connection is lost or the session
+     * destroyed. @n
+     * Events are handed to the callback if there is one, queued otherwise.
+     * @see EventStream
+     */
+    auto ReadEvents() -> void {
+        Connection &c = *events.conn;
+        IPCBuffer ret = IPCBuffer{ MAX_IPC_RETURN_SIZE, c.ret_buffer };
+        while (!events.stopping) {
+            // we wake up regularly to notice the session being destroyed
+            struct pollfd fd = { c.sock, POLLIN, 0 };
+            if (c.read_ahead.empty() && poll_portable(&fd, 1, 50) == 0)
+                continue;
+            // events come whenever they want to, but not piece by piece: an
+            // emulator stopping halfway through one must not block us, and
+            // whoever waits for us to return, forever
+            c.deadline = std::chrono::steady_clock::now() +
+                         std::chrono::milliseconds(EVENT_READ_TIMEOUT);
+            if (ReadReply(c, ret) != Success ||
+                (unsigned char)c.ret_buffer[4] != IPC_EVENT)
+                break;
+            uint32_t size = FromArray<uint32_t>(c.ret_buffer, 0);
+            if (size < 4 + 1 + 8)
+                break;
+            WatchEvent event{
+                FromArray<uint32_t>(c.ret_buffer, 5),
+                FromArray<uint32_t>(c.ret_buffer, 9),
+                std::vector<char>(&c.ret_buffer[13], &c.ret_buffer[size])
+            };
+
+            std::unique_lock<std::mutex> lock(events.queue_blocking);
+            if (events.callback) {
+                // the callback is free to use the session
+                auto callback = events.callback;
+                lock.unlock();
+                callback(event);
+            } else {
+                events.queue.push_back(std::move(event));
+                events.queue_ready.notify_all();
+            }
+        }
+        CloseSocket(c);
+        std::lock_guard<std::mutex> lock(events.queue_blocking);
+        events.open = false;
+        events.queue_ready.notify_all();
+    }
+
+  public:
+    /**
+     * Sends an IPC command to the emulator. @n
+     * Fails if the IPC cannot be sent or if the emulator returns IPC_FAIL.
+     * Throws an IPCStatus on failure.
+     * @param cmd An IPCBuffer containing the IPC command size and buffer OR a
+     * BatchCommand.
+     * @param rt An IPCBuffer containing the IPC return size and buffer.
+     * @see IPCResult
+     * @see IPCBuffer
+     */
+    template <typename T>
+    auto SendCommand(const T &cmd, const T &rt = T()) -> void {
+        Connection &c = Conn();
+        std::lock_guard<std::mutex> lock(c.ipc_blocking);
+        SendCommand(c, cmd, rt);
+    }
+
+    /**
+     * Sends a batch command without waiting for its reply. @n
+     * Multiple commands can be submitted back to back and their replies
+     * collected afterwards with Complete, paying for a single round trip
+     * instead of one per command. @n
+     * Fails if the IPC cannot be sent. Throws an IPCStatus on failure. @n
+     * The BatchCommand must stay alive, and must not be sent again, until it
+     * is completed. With ConnectionPool set, commands have to be completed by
+     * the thread that submitted them.
+     * @param cmd The BatchCommand to send.
+     * @return A ticket to hand over to Complete.
+     * @see Complete
+     */
+    auto Submit(const BatchCommand &cmd) -> uint64_t {
+        Connection &c = Conn();
+        std::lock_guard<std::mutex> lock(c.ipc_blocking);
+        Arm(c);
+        if (!WriteCommand(c, cmd.ipc_message)) {
+            SetError(c.timed_out ? Timeout : NoConnection);
+            return 0;
+        }
+        uint64_t ticket = c.next_ticket++;
+        c.in_flight.push_back(
+            Connection::InFlight{ ticket, &cmd, false, Success });
+        return ticket;
+    }
+
+    /**
+     * Waits for the reply of a submitted batch command. @n
+     * Replies of the commands submitted before it are read along the way and
+     * kept until they are completed themselves. Once completed, GetReply can
+     * be used on the BatchCommand as if it had been sent with SendCommand.
+     * @n Fails if the reply cannot be read or if the emulator returns
+     * IPC_FAIL. Throws an IPCStatus on failure.
+     * @param ticket The ticket returned by Submit.
+     * @see Submit
+     */
+    auto Complete(uint64_t ticket) -> void {
+        Connection &c = Conn();
+        std::lock_guard<std::mutex> lock(c.ipc_blocking);
+        auto pending = std::find_if(
+            c.in_flight.begin(), c.in_flight.end(),
+            [ticket](const auto &entry) { return entry.ticket == ticket; });
+        if (pending == c.in_flight.end()) {
+            SetError(Unknown);
+            return;
         }
+        Arm(c);
+        while (!pending->done)
+            CompleteOne(c);
+        IPCStatus status = pending->status;
+        c.in_flight.erase(pending);
+        if (status != Success)
+            SetError(status);
     }
 
     /**
@@ -748,61 +2381,87 @@ class Shared {
      * have to send the command yourself, along with dealing with the
      * extraction of return values, if need there is. It is a little bit
      * less convenient than the standard IPC but has, at the very least, a
-     * 1000x speedup on big commands.
-     * @see batch_blocking
-     * @see batch_len
-     * @see reply_len
-     * @see arg_cnt
+     * 1000x speedup on big commands. @n
+     * With ConnectionPool set, the batch is built on the connection of the
+     * calling thread, leaving other threads free to use theirs.
+     * @see Connection::batch_blocking
+     * @see Connection::batch_len
+     * @see Connection::reply_len
+     * @see Connection::arg_cnt
      * @see FinalizeBatch
      */
     auto InitializeBatch() -> void {
-        batch_blocking.lock();
-        ipc_blocking.lock();
+        Connection &c = Conn();
+        c.batch_blocking.lock();
+        c.ipc_blocking.lock();
+        c.batching = true;
         // 0-3 = header size, 4 = opcode
-        batch_len = 4;
-        reply_len = 5;
-        needs_reloc = false;
-        arg_cnt = 0;
+        c.batch_len = 4;
+        c.reply_len = 5;
+        c.needs_reloc = false;
+        c.arg_cnt = 0;
+        c.spilled_batch.clear();
+        c.spilled_arg_place.clear();
+        c.spilled_reply_len = 0;
+        c.spilled_frames = 0;
+        c.conditions.clear();
     }
 
     /**
      * Finalizes a batch command IPC message. @n
      * WARNING: You will ALWAYS have to call a FinalizeBatch, even on
      * exceptions, once an InitializeBatch has been called overthise the
-     * class will deadlock.
+     * class will deadlock. @n
+     * Batches too big for a single IPC message are split into as many as
+     * needed, which are sent back to back. This is transparent: reply
+     * indices of GetReply still span the whole batch.
      * @return A BatchCommand with:
      *         * The IPCBuffer of the message.
      *         * The IPCBuffer of the return.
      *         * The argument location in the reply buffer.
-     * @see batch_blocking
-     * @see batch_len
-     * @see reply_len
-     * @see arg_cnt
+     * @see Connection::batch_blocking
+     * @see Connection::batch_len
+     * @see Connection::reply_len
+     * @see Connection::arg_cnt
      * @see InitializeBatch
      * @see IPCBuffer
      * @see BatchCommand
      */
     auto FinalizeBatch() -> BatchCommand {
+        Connection &c = Conn();
         // save size in IPC message header.
-        ToArray<uint32_t>(ipc_buffer, batch_len, 0);
-
-        // we copy our arrays to unblock the IPC class.
-        int bl = batch_len;
-        int rl = needs_reloc ? MAX_IPC_RETURN_SIZE : reply_len;
-        char *c_cmd = new char[batch_len];
-        memcpy(c_cmd, ipc_buffer, batch_len * sizeof(char));
+        ToArray<uint32_t>(c.ipc_buffer, c.batch_len, 0);
+
+        // we copy our arrays to unblock the IPC class, the frames spilled
+        // along the way, if any, go first.
+        unsigned int spilled_len = c.spilled_batch.size();
+        unsigned int spilled_cnt = c.spilled_arg_place.size();
+        int bl = spilled_len + c.batch_len;
+        // when relocation is needed this is only the minimum size of the
+        // reply, SendCommand grows it as needed upon receiving it.
+        int rl = c.spilled_reply_len + c.reply_len;
+        unsigned int cnt = spilled_cnt + c.arg_cnt;
+        unsigned int frames = c.spilled_frames + 1;
+        bool reloc = c.needs_reloc;
+        char *c_cmd = new char[bl];
+        std::copy(c.spilled_batch.begin(), c.spilled_batch.end(), c_cmd);
+        memcpy(&c_cmd[spilled_len], c.ipc_buffer, c.batch_len * sizeof(char));
         char *c_ret = new char[rl];
-        memcpy(c_ret, ret_buffer, rl * sizeof(char));
-        unsigned int *arg_place = new unsigned int[arg_cnt];
-        memcpy(arg_place, batch_arg_place, arg_cnt * sizeof(unsigned int));
+        unsigned int *arg_place = new unsigned int[cnt];
+        std::copy(c.spilled_arg_place.begin(), c.spilled_arg_place.end(),
+                  arg_place);
+        for (unsigned int i = 0; i < c.arg_cnt; i++)
+            arg_place[spilled_cnt + i] =
+                c.batch_arg_place[i] + c.spilled_reply_len;
 
         // we unblock the mutex
-        batch_blocking.unlock();
-        ipc_blocking.unlock();
+        c.batching = false;
+        c.batch_blocking.unlock();
+        c.ipc_blocking.unlock();
 
         // MultiCommand is done!
         return BatchCommand{ IPCBuffer{ bl, c_cmd }, IPCBuffer{ rl, c_ret },
-                             arg_place, arg_cnt, needs_reloc };
+                             arg_place, cnt, reloc, frames };
     }
 
     /**
@@ -822,6 +2481,7 @@ class Shared {
      */
     template <typename Y, bool T = false>
     auto Read(uint32_t address) {
+        Connection &c = Conn();
 
         // easiest way to get tag into a constexpr is a lambda, necessary
         // for GetReply
@@ -846,26 +2506,107 @@ class Shared {
 
         // batch mode
         if constexpr (T) {
-            if (BatchSafetyChecks(5, sizeof(Y))) {
+            if (BatchSafetyChecks(c, 5, sizeof(Y))) {
                 SetError(OutOfMemory);
                 return (char *)0;
             }
             char *cmd =
-                FormatBeginning<true>(&ipc_buffer[batch_len], address, tag);
-            batch_len += 5;
-            batch_arg_place[arg_cnt] = reply_len;
-            reply_len += sizeof(Y);
-            arg_cnt += 1;
+                FormatBeginning<true>(&c.ipc_buffer[c.batch_len], address, tag);
+            c.batch_len += 5;
+            c.batch_arg_place[c.arg_cnt] = c.reply_len;
+            c.reply_len += sizeof(Y);
+            c.arg_cnt += 1;
             return cmd;
         } else {
             // we are already locked in batch mode
-            std::lock_guard<std::mutex> lock(ipc_blocking);
+            std::lock_guard<std::mutex> lock(c.ipc_blocking);
             IPCBuffer cmd =
                 IPCBuffer{ 4 + 5,
-                           FormatBeginning(ipc_buffer, address, tag, 4 + 5) };
-            IPCBuffer ret = IPCBuffer{ 1 + sizeof(Y) + 4, ret_buffer };
-            SendCommand(cmd, ret);
-            return GetReply<tag>(ret_buffer, 5);
+                           FormatBeginning(c.ipc_buffer, address, tag, 4 + 5) };
+            IPCBuffer ret = IPCBuffer{ 1 + sizeof(Y) + 4, c.ret_buffer };
+            SendCommand(c, cmd, ret);
+            return GetReply<tag>(c.ret_buffer, 5);
+        }
+    }
+
+    /**
+     * Reads a value behind a chain of pointers, dereferenced by the emulator
+     * in a single round trip. @n
+     * Starting from base, every offset is added to the 32 bit pointer read
+     * at the current address, the value being read at the last one: with
+     * offsets 0x10 and 0x48 it is at [[base] + 0x10] + 0x48. @n
+     * On error throws an IPCStatus, eg if a pointer leads out of memory. @n
+     * Format: XX YY YY YY YY WW NN (OO OO OO OO*NN) @n
+     * Legend: XX = IPC Tag, YY = Base address, WW = Size of the value,
+     * NN = Number of offsets, OO = Offset. @n
+     * Return: (ZZ*??) @n
+     * Legend: ZZ = Value read.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @see GetReply
+     * @param base The address the chain starts at.
+     * @param offsets The offsets to add to every pointer of the chain.
+     * @param T Flag to enable batch processing or not.
+     * @param Y The type of the variable to read (eg uint8_t).
+     * @return If in batch mode the IPC message otherwise the value read. @n
+     * In batch mode, the reply is read with the GetReply of the MsgRead
+     * command of the same size, eg GetReply<MsgRead32> for an uint32_t.
+     */
+    template <typename Y, bool T = false, typename... O>
+    auto ReadPointerChain(uint32_t base, O... offsets) {
+        static_assert(sizeof...(O) <= UINT8_MAX, "too many offsets");
+        Connection &c = Conn();
+        constexpr IPCCommand tag = MsgReadPointerChain;
+
+        // the reply is the one of a read of the same size
+        constexpr IPCCommand reply_tag = []() -> IPCCommand {
+            switch (sizeof(Y)) {
+                case 1:
+                    return MsgRead8;
+                case 2:
+                    return MsgRead16;
+                case 4:
+                    return MsgRead32;
+                case 8:
+                    return MsgRead64;
+                default:
+                    return MsgUnimplemented;
+            }
+        }();
+        if constexpr (reply_tag == MsgUnimplemented) {
+            SetError(Unimplemented);
+            return;
+        }
+        constexpr int size = 5 + 2 + 4 * sizeof...(O);
+        auto chain = [&](char *cmd, int at) {
+            cmd[at] = sizeof(Y);
+            cmd[at + 1] = sizeof...(O);
+            at += 2;
+            ((ToArray<uint32_t>(cmd, offsets, at), at += 4), ...);
+        };
+
+        // batch mode
+        if constexpr (T) {
+            if (BatchSafetyChecks(c, size, sizeof(Y))) {
+                SetError(OutOfMemory);
+                return (char *)0;
+            }
+            char *cmd =
+                FormatBeginning<true>(&c.ipc_buffer[c.batch_len], base, tag);
+            chain(cmd, 5);
+            c.batch_len += size;
+            c.batch_arg_place[c.arg_cnt] = c.reply_len;
+            c.reply_len += sizeof(Y);
+            c.arg_cnt += 1;
+            return cmd;
+        } else {
+            // we are already locked in batch mode
+            std::lock_guard<std::mutex> lock(c.ipc_blocking);
+            char *cmd = FormatBeginning(c.ipc_buffer, base, tag, 4 + size);
+            chain(cmd, 4 + 5);
+            IPCBuffer ret = IPCBuffer{ 1 + sizeof(Y) + 4, c.ret_buffer };
+            SendCommand(c, IPCBuffer{ 4 + size, cmd }, ret);
+            return GetReply<reply_tag>(c.ret_buffer, 5);
         }
     }
 
@@ -878,12 +2619,17 @@ class Shared {
      * @see IPCStatus
      * @param address The address to write to.
      * @param value The value to write.
+     * @param slot If in batch mode and not null, filled with the location of
+     * the value in the batch, to later change it with Patch.
      * @param T Flag to enable batch processing or not.
      * @param Y The type of the variable to write (eg uint8_t).
      * @return If in batch mode the IPC message otherwise void.
+     * @see Patch
      */
     template <typename Y, bool T = false>
-    auto Write(uint32_t address, Y value) {
+    auto Write(uint32_t address, Y value,
+               [[maybe_unused]] BatchSlot<Y> *slot = nullptr) {
+        Connection &c = Conn();
 
         // easiest way to get tag into a constexpr is a lambda, necessary
         // for GetReply
@@ -908,23 +2654,308 @@ class Shared {
 
         // batch mode
         if constexpr (T) {
-            if (BatchSafetyChecks(5 + sizeof(Y))) {
+            if (BatchSafetyChecks(c, 5 + sizeof(Y))) {
                 SetError(OutOfMemory);
                 return (char *)0;
             }
             char *cmd = ToArray<Y>(
-                FormatBeginning<true>(&ipc_buffer[batch_len], address, tag),
+                FormatBeginning<true>(&c.ipc_buffer[c.batch_len], address, tag),
                 value, 5);
-            batch_len += 5 + sizeof(Y);
-            arg_cnt += 1;
+            if (slot)
+                slot->offset = c.spilled_batch.size() + c.batch_len + 5;
+            c.batch_len += 5 + sizeof(Y);
+            // no reply, but relocation still walks over every argument.
+            c.batch_arg_place[c.arg_cnt] = c.reply_len;
+            c.arg_cnt += 1;
             return cmd;
         } else {
             // we are already locked in batch mode
-            std::lock_guard<std::mutex> lock(ipc_blocking);
+            std::lock_guard<std::mutex> lock(c.ipc_blocking);
             int size = 4 + 5 + sizeof(Y);
-            char *cmd = ToArray(FormatBeginning(ipc_buffer, address, tag, size),
-                                value, 4 + 5);
-            SendCommand(IPCBuffer{ size, cmd }, IPCBuffer{ 1 + 4, ret_buffer });
+            char *cmd =
+                ToArray(FormatBeginning(c.ipc_buffer, address, tag, size),
+                        value, 4 + 5);
+            SendCommand(c, IPCBuffer{ size, cmd },
+                        IPCBuffer{ 1 + 4, c.ret_buffer });
+            return;
+        }
+    }
+
+    /**
+     * Modifies a value in the emulator's game memory, eg to increment a
+     * counter. @n
+     * The emulator reads, modifies and writes the value back at once, which
+     * takes a single round trip and does not race with the game. @n
+     * On error throws an IPCStatus. @n
+     * Format: XX YY YY YY YY OO (ZZ*??) @n
+     * Legend: XX = IPC Tag, YY = Address, OO = Operation, ZZ = Operand. @n
+     * Return: (ZZ*??) @n
+     * Legend: ZZ = Value before the modification.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @see GetReply
+     * @param address The address of the value to modify.
+     * @param op The operation to apply to it.
+     * @param value The operand of the operation.
+     * @param T Flag to enable batch processing or not.
+     * @param Y The type of the variable to modify (eg uint8_t).
+     * @return If in batch mode the IPC message otherwise the value before
+     * the modification.
+     * @see ModifyOp
+     */
+    template <typename Y, bool T = false>
+    auto Modify(uint32_t address, ModifyOp op, Y value) {
+        Connection &c = Conn();
+
+        // easiest way to get tag into a constexpr is a lambda, necessary
+        // for GetReply
+        constexpr IPCCommand tag = []() -> IPCCommand {
+            switch (sizeof(Y)) {
+                case 1:
+                    return MsgModify8;
+                case 2:
+                    return MsgModify16;
+                case 4:
+                    return MsgModify32;
+                case 8:
+                    return MsgModify64;
+                default:
+                    return MsgUnimplemented;
+            }
+        }();
+        if constexpr (tag == MsgUnimplemented) {
+            SetError(Unimplemented);
+            return;
+        }
+
+        // batch mode
+        if constexpr (T) {
+            if (BatchSafetyChecks(c, 6 + sizeof(Y), sizeof(Y))) {
+                SetError(OutOfMemory);
+                return (char *)0;
+            }
+            char *cmd =
+                FormatBeginning<true>(&c.ipc_buffer[c.batch_len], address, tag);
+            cmd[5] = op;
+            ToArray<Y>(cmd, value, 6);
+            c.batch_len += 6 + sizeof(Y);
+            c.batch_arg_place[c.arg_cnt] = c.reply_len;
+            c.reply_len += sizeof(Y);
+            c.arg_cnt += 1;
+            return cmd;
+        } else {
+            // we are already locked in batch mode
+            std::lock_guard<std::mutex> lock(c.ipc_blocking);
+            int size = 4 + 6 + sizeof(Y);
+            char *cmd = FormatBeginning(c.ipc_buffer, address, tag, size);
+            cmd[4 + 5] = op;
+            ToArray<Y>(cmd, value, 4 + 6);
+            IPCBuffer ret = IPCBuffer{ 1 + sizeof(Y) + 4, c.ret_buffer };
+            SendCommand(c, IPCBuffer{ size, cmd }, ret);
+            return GetReply<tag>(c.ret_buffer, 5);
+        }
+    }
+
+    /**
+     * Begins a conditional block of a batch command. @n
+     * The emulator only executes the commands added until the matching
+     * EndIf if the condition holds when it gets to them; otherwise they are
+     * skipped, their replies being zeroed. Blocks can be nested, and have to
+     * fit in a single IPC message. @n
+     * Only valid in batch mode. @n
+     * Format: XX YY YY YY YY WW CC (ZZ*WW) NN NN NN NN @n
+     * Legend: XX = IPC Tag, YY = Address, WW = Size of the value,
+     * CC = Condition, ZZ = Operand, NN = Number of commands in the block. @n
+     * Return: RR @n
+     * Legend: RR = Whether the condition held.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @see EndIf
+     * @param address The address of the value to compare.
+     * @param condition How to compare it.
+     * @param value The operand to compare it to.
+     * @param Y The type of the variable to compare (eg uint8_t).
+     * @return The IPC message. Its reply is read with GetReply<MsgRead8>.
+     * @see Condition
+     */
+    template <typename Y>
+    auto BeginIf(uint32_t address, Condition condition, Y value) -> char * {
+        static_assert(sizeof(Y) == 1 || sizeof(Y) == 2 || sizeof(Y) == 4 ||
+                          sizeof(Y) == 8,
+                      "only integers can be compared");
+        Connection &c = Conn();
+        constexpr int size = 5 + 2 + sizeof(Y) + 4;
+        if (BatchSafetyChecks(c, size, 1)) {
+            SetError(OutOfMemory);
+            return (char *)0;
+        }
+        char *cmd =
+            FormatBeginning<true>(&c.ipc_buffer[c.batch_len], address, MsgIf);
+        cmd[5] = sizeof(Y);
+        cmd[6] = condition;
+        ToArray<Y>(cmd, value, 7);
+        // the command count is only known once the block ends
+        ToArray<uint32_t>(cmd, 0, 7 + sizeof(Y));
+        c.conditions.push_back({ (unsigned int)c.spilled_arg_place.size() +
+                                     c.arg_cnt,
+                                 c.batch_len + 7 + sizeof(Y) });
+        c.batch_len += size;
+        c.batch_arg_place[c.arg_cnt] = c.reply_len;
+        c.reply_len += 1;
+        c.arg_cnt += 1;
+        return cmd;
+    }
+
+    /**
+     * Ends the last conditional block begun in a batch command. @n
+     * On error throws an IPCStatus, OutOfMemory if the block did not fit in
+     * a single IPC message. @n
+     * Only valid in batch mode.
+     * @see BeginIf
+     */
+    auto EndIf() -> void {
+        Connection &c = Conn();
+        if (c.conditions.empty()) {
+            SetError(Fail);
+            return;
+        }
+        auto [index, at] = c.conditions.back();
+        c.conditions.pop_back();
+        unsigned int spilled = c.spilled_arg_place.size();
+        // the emulator cannot skip commands of another message
+        if (index < spilled) {
+            SetError(OutOfMemory);
+            return;
+        }
+        ToArray<uint32_t>(c.ipc_buffer, spilled + c.arg_cnt - index - 1, at);
+    }
+
+    /**
+     * Reads a contiguous block from the emulator's memory. @n
+     * On error throws an IPCStatus. @n
+     * Format: XX YY YY YY YY LL LL LL LL @n
+     * Legend: XX = IPC Tag, YY = Address, LL = Length. @n
+     * Return: (ZZ*LL) @n
+     * Legend: ZZ = Block read.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @see GetReply
+     * @param address The address to start reading at.
+     * @param length The number of bytes to read.
+     * @param dst Where to copy the block to, only optional in batch mode,
+     * where it is unused: use GetReply<MsgReadRange> instead.
+     * @param T Flag to enable batch processing or not.
+     * @return If in batch mode the IPC message otherwise void. @n
+     * Outside of batch mode, blocks bigger than what a single reply can hold
+     * are transparently split into multiple IPC messages.
+     */
+    template <bool T = false>
+    auto ReadRange(uint32_t address, uint32_t length,
+                   [[maybe_unused]] void *dst) {
+        Connection &c = Conn();
+        constexpr IPCCommand tag = MsgReadRange;
+
+        // batch mode
+        if constexpr (T) {
+            if (BatchSafetyChecks(c, 9, length)) {
+                SetError(OutOfMemory);
+                return (char *)0;
+            }
+            char *cmd = ToArray(
+                FormatBeginning<true>(&c.ipc_buffer[c.batch_len], address, tag),
+                length, 5);
+            c.batch_len += 9;
+            c.batch_arg_place[c.arg_cnt] = c.reply_len;
+            c.reply_len += length;
+            c.arg_cnt += 1;
+            return cmd;
+        } else {
+            // we are already locked in batch mode
+            std::lock_guard<std::mutex> lock(c.ipc_blocking);
+            char *out = (char *)dst;
+            while (length > 0) {
+                uint32_t chunk =
+                    std::min<uint32_t>(length, MAX_IPC_RETURN_SIZE - 4 - 1);
+                ToArray(FormatBeginning(c.ipc_buffer, address, tag, 4 + 9),
+                        chunk, 4 + 5);
+                // the C bindings do not throw: stop at the first error
+                if (!SendCommand(c, IPCBuffer{ 4 + 9, c.ipc_buffer },
+                                 IPCBuffer{ (int)(4 + 1 + chunk),
+                                            c.ret_buffer }))
+                    return;
+                memcpy(out, &c.ret_buffer[5], chunk);
+                out += chunk;
+                address += chunk;
+                length -= chunk;
+            }
+            return;
+        }
+    }
+
+    /**
+     * Reads a contiguous block from the emulator's memory, in batch mode. @n
+     * Outside of batch mode the block has to be copied somewhere.
+     * @see ReadRange
+     */
+    template <bool T = false>
+    auto ReadRange(uint32_t address, uint32_t length) {
+        static_assert(T, "ReadRange needs a destination outside batch mode");
+        return ReadRange<T>(address, length, nullptr);
+    }
+
+    /**
+     * Writes a contiguous block to the emulator's memory. @n
+     * On error throws an IPCStatus. @n
+     * Format: XX YY YY YY YY LL LL LL LL (ZZ*LL) @n
+     * Legend: XX = IPC Tag, YY = Address, LL = Length, ZZ = Block.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @param address The address to start writing at.
+     * @param src The block to write.
+     * @param length The number of bytes to write.
+     * @param T Flag to enable batch processing or not.
+     * @return If in batch mode the IPC message otherwise void. @n
+     * Outside of batch mode, blocks bigger than what a single message can
+     * hold are transparently split into multiple IPC messages.
+     */
+    template <bool T = false>
+    auto WriteRange(uint32_t address, const void *src, uint32_t length) {
+        Connection &c = Conn();
+        constexpr IPCCommand tag = MsgWriteRange;
+
+        // batch mode
+        if constexpr (T) {
+            if (BatchSafetyChecks(c, 9 + length)) {
+                SetError(OutOfMemory);
+                return (char *)0;
+            }
+            char *cmd = ToArray(
+                FormatBeginning<true>(&c.ipc_buffer[c.batch_len], address, tag),
+                length, 5);
+            memcpy(&cmd[9], src, length);
+            c.batch_len += 9 + length;
+            // no reply, but relocation still walks over every argument.
+            c.batch_arg_place[c.arg_cnt] = c.reply_len;
+            c.arg_cnt += 1;
+            return cmd;
+        } else {
+            // we are already locked in batch mode
+            std::lock_guard<std::mutex> lock(c.ipc_blocking);
+            const char *in = (const char *)src;
+            while (length > 0) {
+                uint32_t chunk =
+                    std::min<uint32_t>(length, MAX_IPC_SIZE - 4 - 9);
+                int size = 4 + 9 + chunk;
+                ToArray(FormatBeginning(c.ipc_buffer, address, tag, size),
+                        chunk, 4 + 5);
+                memcpy(&c.ipc_buffer[4 + 9], in, chunk);
+                if (!SendCommand(c, IPCBuffer{ size, c.ipc_buffer },
+                                 IPCBuffer{ 1 + 4, c.ret_buffer }))
+                    return;
+                in += chunk;
+                address += chunk;
+                length -= chunk;
+            }
             return;
         }
     }
@@ -950,6 +2981,22 @@ class Shared {
         return StringCommands<tag, T>();
     }
 
+    /**
+     * Retrieves the emulator's version into a buffer you provide. @n
+     * On error throws an IPCStatus. @n
+     * Unlike Version, this does not allocate anything, which makes it
+     * suitable for hot loops.
+     * @param dst The buffer to copy the string into. It is always NUL
+     * terminated, truncating the string if needed.
+     * @param size The size of dst.
+     * @return The length of the string. If bigger than or equal to size the
+     * string was truncated.
+     * @see Version
+     */
+    auto Version(char *dst, size_t size) -> size_t {
+        return StringCommands<MsgVersion>(dst, size);
+    }
+
     /**
      * Retrieves emulator status. @n
      * On error throws an IPCStatus. @n
@@ -965,28 +3012,29 @@ class Shared {
      */
     template <bool T = false>
     auto Status() {
+        Connection &c = Conn();
         constexpr IPCCommand tag = MsgStatus;
         // batch mode
         if constexpr (T) {
-            if (BatchSafetyChecks(1, 4)) {
+            if (BatchSafetyChecks(c, 1, 4)) {
                 SetError(OutOfMemory);
                 return (char *)0;
             }
-            char *cmd = &ipc_buffer[batch_len];
+            char *cmd = &c.ipc_buffer[c.batch_len];
             cmd[0] = tag;
-            batch_len += 1;
-            batch_arg_place[arg_cnt] = reply_len;
-            reply_len += 4;
-            arg_cnt += 1;
+            c.batch_len += 1;
+            c.batch_arg_place[c.arg_cnt] = c.reply_len;
+            c.reply_len += 4;
+            c.arg_cnt += 1;
             return cmd;
         } else {
             // we are already locked in batch mode
-            std::lock_guard<std::mutex> lock(ipc_blocking);
-            ToArray(ipc_buffer, 4 + 1, 0);
-            ipc_buffer[4] = tag;
-            SendCommand(IPCBuffer{ 4 + 1, ipc_buffer },
-                        IPCBuffer{ 4 + 1 + 4, ret_buffer });
-            return GetReply<tag>(ret_buffer, 5);
+            std::lock_guard<std::mutex> lock(c.ipc_blocking);
+            ToArray(c.ipc_buffer, 4 + 1, 0);
+            c.ipc_buffer[4] = tag;
+            SendCommand(c, IPCBuffer{ 4 + 1, c.ipc_buffer },
+                        IPCBuffer{ 4 + 1 + 4, c.ret_buffer });
+            return GetReply<tag>(c.ret_buffer, 5);
         }
     }
 
@@ -1011,6 +3059,22 @@ class Shared {
         return StringCommands<tag, T>();
     }
 
+    /**
+     * Retrieves the game title into a buffer you provide. @n
+     * On error throws an IPCStatus. @n
+     * Unlike GetGameTitle, this does not allocate anything, which makes it
+     * suitable for hot loops.
+     * @param dst The buffer to copy the string into. It is always NUL
+     * terminated, truncating the string if needed.
+     * @param size The size of dst.
+     * @return The length of the string. If bigger than or equal to size the
+     * string was truncated.
+     * @see GetGameTitle
+     */
+    auto GetGameTitle(char *dst, size_t size) -> size_t {
+        return StringCommands<MsgTitle>(dst, size);
+    }
+
     /**
      * Retrieves the game ID. @n
      * On error throws an IPCStatus. @n
@@ -1032,6 +3096,22 @@ class Shared {
         return StringCommands<tag, T>();
     }
 
+    /**
+     * Retrieves the game ID into a buffer you provide. @n
+     * On error throws an IPCStatus. @n
+     * Unlike GetGameID, this does not allocate anything, which makes it
+     * suitable for hot loops.
+     * @param dst The buffer to copy the string into. It is always NUL
+     * terminated, truncating the string if needed.
+     * @param size The size of dst.
+     * @return The length of the string. If bigger than or equal to size the
+     * string was truncated.
+     * @see GetGameID
+     */
+    auto GetGameID(char *dst, size_t size) -> size_t {
+        return StringCommands<MsgID>(dst, size);
+    }
+
     /**
      * Retrieves the game UUID. @n
      * On error throws an IPCStatus. @n
@@ -1053,6 +3133,22 @@ class Shared {
         return StringCommands<tag, T>();
     }
 
+    /**
+     * Retrieves the game UUID into a buffer you provide. @n
+     * On error throws an IPCStatus. @n
+     * Unlike GetGameUUID, this does not allocate anything, which makes it
+     * suitable for hot loops.
+     * @param dst The buffer to copy the string into. It is always NUL
+     * terminated, truncating the string if needed.
+     * @param size The size of dst.
+     * @return The length of the string. If bigger than or equal to size the
+     * string was truncated.
+     * @see GetGameUUID
+     */
+    auto GetGameUUID(char *dst, size_t size) -> size_t {
+        return StringCommands<MsgUUID>(dst, size);
+    }
+
     /**
      * Retrieves the game version. @n
      * On error throws an IPCStatus. @n
@@ -1074,6 +3170,22 @@ class Shared {
         return StringCommands<tag, T>();
     }
 
+    /**
+     * Retrieves the game version into a buffer you provide. @n
+     * On error throws an IPCStatus. @n
+     * Unlike GetGameVersion, this does not allocate anything, which makes it
+     * suitable for hot loops.
+     * @param dst The buffer to copy the string into. It is always NUL
+     * terminated, truncating the string if needed.
+     * @param size The size of dst.
+     * @return The length of the string. If bigger than or equal to size the
+     * string was truncated.
+     * @see GetGameVersion
+     */
+    auto GetGameVersion(char *dst, size_t size) -> size_t {
+        return StringCommands<MsgGameVersion>(dst, size);
+    }
+
     /**
      * Asks the emulator to save a savestate. @n
      * On error throws an IPCStatus. @n
@@ -1108,16 +3220,223 @@ class Shared {
         return EmuState<tag, T>(slot);
     }
 
+    /**
+     * Waits for the end of the current frame. @n
+     * On error throws an IPCStatus. @n
+     * In batch mode, the commands following it in the IPC message are run
+     * at the end of the next frame, the game being paused until they are
+     * done: a batch starting with it, sent in a loop, runs once per frame
+     * in a single round trip. Batches too big for a single IPC message only
+     * get the commands of the first one run while paused. @n
+     * Format: XX @n
+     * Legend: XX = IPC Tag. @n
+     * Return: FF FF FF FF @n
+     * Legend: FF = Number of frames ended so far.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @see GetReply
+     * @param T Flag to enable batch processing or not.
+     * @return The number of frames ended so far, which tells about frames
+     * missed in between two calls. If in batch mode the IPC message.
+     */
+    template <bool T = false>
+    auto ExecuteOnFrameEnd() {
+        Connection &c = Conn();
+        constexpr IPCCommand tag = MsgFrameEnd;
+        // batch mode
+        if constexpr (T) {
+            if (BatchSafetyChecks(c, 1, 4)) {
+                SetError(OutOfMemory);
+                return (char *)0;
+            }
+            char *cmd = &c.ipc_buffer[c.batch_len];
+            cmd[0] = tag;
+            c.batch_len += 1;
+            c.batch_arg_place[c.arg_cnt] = c.reply_len;
+            c.reply_len += 4;
+            c.arg_cnt += 1;
+            return cmd;
+        } else {
+            // we are already locked in batch mode
+            std::lock_guard<std::mutex> lock(c.ipc_blocking);
+            ToArray(c.ipc_buffer, 4 + 1, 0);
+            c.ipc_buffer[4] = tag;
+            SendCommand(c, IPCBuffer{ 4 + 1, c.ipc_buffer },
+                        IPCBuffer{ 4 + 1 + 4, c.ret_buffer });
+            return GetReply<tag>(c.ret_buffer, 5);
+        }
+    }
+
+    /**
+     * Returns the subscriber identifier of the event connection of the
+     * session, opening it first if needed. @n
+     * The identifier changes whenever the event connection is opened again,
+     * eg after the emulator restarted. @n
+     * On error throws an IPCStatus.
+     * @return The identifier, 0 on error under C_FFI.
+     * @see Watch
+     */
+    auto Subscriber() -> uint32_t { return Subscribe(); }
+
+    /**
+     * Watches a memory block for changes. @n
+     * On error throws an IPCStatus. @n
+     * The emulator checks the block at the end of every frame, and pushes
+     * its new contents whenever it changed, which you can get with NextEvent
+     * or OnWatch. The first call opens the event connection of the session.
+     * @n Format: XX SS SS SS SS YY YY YY YY LL LL LL LL @n
+     * Legend: XX = IPC Tag, SS = Subscriber, YY = Address, LL = Length. @n
+     * Return: II II II II @n
+     * Legend: II = Watch identifier.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @see GetReply
+     * @param address The address of the block.
+     * @param length The length of the block.
+     * @param slot If in batch mode and not null, filled with the location of
+     * the subscriber in the batch. A batch is tied to the event connection
+     * it was built with: should it be opened again, the subscriber changes
+     * and has to be patched, see Subscriber, before sending the batch again.
+     * @param T Flag to enable batch processing or not.
+     * @return The watch identifier. If in batch mode the IPC message.
+     * @see Unwatch
+     * @see Patch
+     */
+    template <bool T = false>
+    auto Watch(uint32_t address, uint32_t length,
+               [[maybe_unused]] BatchSlot<uint32_t> *slot = nullptr) {
+        constexpr IPCCommand tag = MsgWatch;
+        uint32_t subscriber = Subscribe();
+        Connection &c = Conn();
+
+        // batch mode
+        if constexpr (T) {
+            if (subscriber == 0)
+                return (char *)0;
+            if (BatchSafetyChecks(c, 13, 4)) {
+                SetError(OutOfMemory);
+                return (char *)0;
+            }
+            char *cmd =
+                FormatBeginning<true>(&c.ipc_buffer[c.batch_len], 0, tag);
+            ToArray(cmd, subscriber, 1);
+            ToArray(cmd, address, 5);
+            ToArray(cmd, length, 9);
+            if (slot)
+                slot->offset = c.spilled_batch.size() + c.batch_len + 1;
+            c.batch_len += 13;
+            c.batch_arg_place[c.arg_cnt] = c.reply_len;
+            c.reply_len += 4;
+            c.arg_cnt += 1;
+            return cmd;
+        } else {
+            if (subscriber == 0)
+                return (uint32_t)0;
+            // we are already locked in batch mode
+            std::lock_guard<std::mutex> lock(c.ipc_blocking);
+            char *cmd = FormatBeginning(c.ipc_buffer, subscriber, tag, 4 + 13);
+            ToArray(cmd, address, 4 + 5);
+            ToArray(cmd, length, 4 + 9);
+            if (!SendCommand(c, IPCBuffer{ 4 + 13, cmd },
+                             IPCBuffer{ 4 + 1 + 4, c.ret_buffer }))
+                return (uint32_t)0;
+            return GetReply<tag>(c.ret_buffer, 5);
+        }
+    }
+
+    /**
+     * Stops watching a memory block. @n
+     * On error throws an IPCStatus. @n
+     * Events of the watch already pushed are still delivered. @n
+     * Format: XX II II II II @n
+     * Legend: XX = IPC Tag, II = Watch identifier.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @param id The watch identifier returned by Watch.
+     * @param T Flag to enable batch processing or not.
+     * @return If in batch mode the IPC message otherwise void.
+     * @see Watch
+     */
+    template <bool T = false>
+    auto Unwatch(uint32_t id) {
+        Connection &c = Conn();
+        constexpr IPCCommand tag = MsgUnwatch;
+
+        // batch mode
+        if constexpr (T) {
+            if (BatchSafetyChecks(c, 5)) {
+                SetError(OutOfMemory);
+                return (char *)0;
+            }
+            char *cmd =
+                FormatBeginning<true>(&c.ipc_buffer[c.batch_len], id, tag);
+            c.batch_len += 5;
+            // no reply, but relocation still walks over every argument.
+            c.batch_arg_place[c.arg_cnt] = c.reply_len;
+            c.arg_cnt += 1;
+            return cmd;
+        } else {
+            // we are already locked in batch mode
+            std::lock_guard<std::mutex> lock(c.ipc_blocking);
+            SendCommand(c,
+                        IPCBuffer{ 4 + 5,
+                                   FormatBeginning(c.ipc_buffer, id, tag,
+                                                   4 + 5) },
+                        IPCBuffer{ 4 + 1, c.ret_buffer });
+            return;
+        }
+    }
+
+    /**
+     * Sets a function to call with every watch event. @n
+     * It is called from the thread reading events, one event at a time, and
+     * is free to use the session. Until set, and once cleared with nullptr,
+     * events are queued for NextEvent instead.
+     * @param callback The function to call, or nullptr.
+     * @see Watch
+     */
+    auto OnWatch(std::function<void(const WatchEvent &)> callback) -> void {
+        std::lock_guard<std::mutex> lock(events.queue_blocking);
+        events.callback = std::move(callback);
+    }
+
+    /**
+     * Waits for the next watch event. @n
+     * Only gets events while no callback is set with OnWatch.
+     * @param event Filled with the event.
+     * @param timeout_ms How long to wait for at most, forever if negative.
+     * @return false if it timed out, or if the event connection is lost and
+     * every event it got was consumed.
+     * @see Watch
+     */
+    auto NextEvent(WatchEvent &event, int timeout_ms = -1) -> bool {
+        std::unique_lock<std::mutex> lock(events.queue_blocking);
+        auto ready = [this]() { return !events.queue.empty() || !events.open; };
+        if (timeout_ms < 0)
+            events.queue_ready.wait(lock, ready);
+        else
+            events.queue_ready.wait_for(
+                lock, std::chrono::milliseconds(timeout_ms), ready);
+        if (events.queue.empty())
+            return false;
+        event = std::move(events.queue.front());
+        events.queue.pop_front();
+        return true;
+    }
+
     /**
      * Shared Initializer.
      * @param slot Slot to use for this IPC session.
      * @param emulator_name Emulator name to use for this IPC session.
      * @param default_slot Whether this is the default slot for the emulator
      * or not.
+     * @param flags Session option flags, see SessionFlags.
      * @see slot
+     * @see SessionFlags
      */
     Shared(const unsigned int slot, const std::string emulator_name,
-           const bool default_slot) {
+           const bool default_slot, const unsigned int flags = DefaultSession)
+        : flags(flags), session_id(next_session_id++) {
         // some basic input sanitization
         if (slot > 65536) {
             SetError(NoConnection);
@@ -1129,6 +3448,42 @@ class Shared {
         WSADATA wsa;
         WSAStartup(MAKEWORD(2, 2), &wsa);
 #else
+        SOCKET_NAME = SocketPath(slot, emulator_name, default_slot);
+#endif
+        // pooled connections are created by each thread on first use
+        if (!(flags & ConnectionPool)) {
+            connection = new Connection();
+            if (!(flags & LazyConnect))
+                InitSocket(*connection);
+        } else {
+            std::lock_guard<std::mutex> lock(pooled_sessions_blocking);
+            pooled_sessions[session_id] = this;
+        }
+    }
+
+#if !defined(_WIN32) || defined(DOXYGEN)
+    /**
+     * Computes the path of the unix socket of an emulator.
+     * @param slot Slot of the IPC session.
+     * @param emulator_name Emulator name of the IPC session.
+     * @param default_slot Whether this is the default slot for the emulator
+     * or not.
+     * @return The path of the socket.
+     */
+    static auto SocketPath(const unsigned int slot,
+                           const std::string &emulator_name,
+                           const bool default_slot) -> std::string {
+        std::string path = RuntimeDir() + "/" + emulator_name + ".sock";
+        if (!default_slot) {
+            path += "." + std::to_string(slot);
+        }
+        return path;
+    }
+
+    /**
+     * Returns the directory emulators create their unix sockets in.
+     */
+    static auto RuntimeDir() -> std::string {
         char *runtime_dir = nullptr;
 #ifdef __APPLE__
         runtime_dir = std::getenv("TMPDIR");
@@ -1138,39 +3493,319 @@ class Shared {
         // fallback in case macOS or other OSes don't implement the XDG base
         // spec
         if (runtime_dir == nullptr)
-            SOCKET_NAME = "/tmp/" + emulator_name + ".sock";
-        else {
-            SOCKET_NAME = runtime_dir;
-            SOCKET_NAME += "/" + emulator_name + ".sock";
+            return "/tmp";
+        return runtime_dir;
+    }
+
+    /**
+     * Names of the emulators supported by this API, as found in the names
+     * of their sockets.
+     */
+    static constexpr const char *emulator_names[] = { "pcsx2", "rpcs3",
+                                                      "duckstation" };
+
+    /**
+     * Status of an emulator socket.
+     * @see Endpoint
+     */
+    enum EndpointStatus : unsigned int {
+        Live = 0,   /**< An emulator accepts connections on it. */
+        Stale = 1,  /**< Nothing listens on it, eg after a crash. */
+        Gone = 2,   /**< It was removed, only reported by SocketWatcher. */
+        Created = 3 /**< It was just created and nothing listens on it yet,
+                         only reported by SocketWatcher. Emulators listen a
+                         bit after creating it: Probe it again. */
+    };
+
+    /**
+     * An emulator socket found in the runtime directory.
+     * @see Discover
+     */
+    struct Endpoint {
+        std::string emulator;  /**< Name of the emulator, eg "pcsx2". */
+        unsigned int slot;     /**< Slot to create a session with, 0 for the
+                                    default one. */
+        std::string path;      /**< Path of the socket. */
+        EndpointStatus status; /**< Whether an emulator is behind it. */
+    };
+
+    /**
+     * Parses the name of a file of the runtime directory.
+     * @param name The name of the file.
+     * @param endpoint Filled with the emulator and slot, if it is the
+     * socket of a supported emulator.
+     * @return Whether it is.
+     */
+    static auto ParseEndpoint(const std::string &name, Endpoint &endpoint)
+        -> bool {
+        for (const char *emulator : emulator_names) {
+            std::string prefix = std::string(emulator) + ".sock";
+            if (name.compare(0, prefix.size(), prefix) != 0)
+                continue;
+            std::string suffix = name.substr(prefix.size());
+            unsigned long slot = 0;
+            if (!suffix.empty()) {
+                char *end;
+                if (suffix[0] != '.' || suffix.size() == 1)
+                    continue;
+                slot = strtoul(&suffix[1], &end, 10);
+                if (*end != '\0' || slot == 0 || slot > 65536)
+                    continue;
+            }
+            endpoint.emulator = emulator;
+            endpoint.slot = slot;
+            endpoint.path = RuntimeDir() + "/" + name;
+            return true;
         }
+        return false;
+    }
 
-        if (!default_slot) {
-            SOCKET_NAME += "." + std::to_string(slot);
+    /**
+     * Checks whether an emulator listens on a socket. @n
+     * Emulators see a client connecting and leaving right away.
+     * @param path The path of the socket.
+     * @return Live or Stale.
+     */
+    static auto Probe(const std::string &path) -> EndpointStatus {
+        struct sockaddr_un server = {};
+        server.sun_family = AF_UNIX;
+        strncpy(server.sun_path, path.c_str(), sizeof(server.sun_path) - 1);
+        int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock < 0)
+            return Stale;
+        bool live = connect(sock, (struct sockaddr *)&server,
+                            sizeof(struct sockaddr_un)) == 0;
+        close_portable(sock);
+        return live ? Live : Stale;
+    }
+
+    /**
+     * Lists the sockets of supported emulators in the runtime directory.
+     * @n Emulator instances can then be attached to without trying to
+     * connect to every slot.
+     * @return The sockets found, live or not.
+     * @see SocketWatcher
+     */
+    static auto Discover() -> std::vector<Endpoint> {
+        std::vector<Endpoint> endpoints;
+        DIR *dir = opendir(RuntimeDir().c_str());
+        if (!dir)
+            return endpoints;
+        while (struct dirent *entry = readdir(dir)) {
+            Endpoint endpoint;
+            if (!ParseEndpoint(entry->d_name, endpoint))
+                continue;
+            struct stat info;
+            if (stat(endpoint.path.c_str(), &info) < 0 ||
+                !S_ISSOCK(info.st_mode))
+                continue;
+            endpoint.status = Probe(endpoint.path);
+            endpoints.push_back(std::move(endpoint));
+        }
+        closedir(dir);
+        return endpoints;
+    }
+#endif
+
+#if defined(__linux__) || defined(DOXYGEN)
+    /**
+     * Watches the runtime directory for emulator sockets coming and going.
+     * @n Sockets created after the watcher are reported right away, as Live
+     * or Created, removed ones as Gone.
+     * @see Discover
+     */
+    class SocketWatcher {
+      public:
+        /**
+         * Waits for the next socket to come or go.
+         * @param endpoint Filled with the socket.
+         * @param timeout_ms How long to wait for at most, forever if
+         * negative.
+         * @return false if it timed out, or if the watcher is not Ok.
+         */
+        auto Next(Endpoint &endpoint, int timeout_ms = -1) -> bool {
+            if (inotify < 0)
+                return false;
+            auto deadline = std::chrono::steady_clock::now() +
+                            std::chrono::milliseconds(timeout_ms);
+            while (pending.empty()) {
+                int wait = -1;
+                if (timeout_ms >= 0)
+                    wait = std::max<long>(
+                        0, std::chrono::duration_cast<
+                               std::chrono::milliseconds>(
+                               deadline - std::chrono::steady_clock::now())
+                               .count());
+                struct pollfd fd = { inotify, POLLIN, 0 };
+                if (poll_portable(&fd, 1, wait) <= 0)
+                    return false;
+                ReadEvents();
+            }
+            endpoint = std::move(pending.front());
+            pending.pop_front();
+            return true;
+        }
+
+        /**
+         * Returns a file descriptor becoming readable when sockets come or
+         * go, to wait on along with others. Next does not block then.
+         */
+        auto Fd() const -> int { return inotify; }
+
+        /**
+         * Returns whether the runtime directory is watched. @n
+         * Fails if it does not exist, or if the system is out of inotify
+         * instances or watches.
+         */
+        auto Ok() const -> bool { return inotify >= 0; }
+
+        SocketWatcher() {
+            inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (inotify >= 0 &&
+                inotify_add_watch(inotify, RuntimeDir().c_str(),
+                                  IN_CREATE | IN_DELETE | IN_MOVED_TO |
+                                      IN_MOVED_FROM) < 0) {
+                close(inotify);
+                inotify = -1;
+            }
+        }
+
+        ~SocketWatcher() {
+            if (inotify >= 0)
+                close(inotify);
+        }
+
+        SocketWatcher(const SocketWatcher &rhs) = delete;
+        SocketWatcher &operator=(const SocketWatcher &rhs) = delete;
+
+      private:
+        /**
+         * Turns the pending inotify events into endpoints.
+         */
+        auto ReadEvents() -> void {
+            alignas(struct inotify_event) char buffer[4096];
+            ssize_t length;
+            while ((length = read(inotify, buffer, sizeof(buffer))) > 0) {
+                for (char *at = buffer; at < buffer + length;) {
+                    struct inotify_event *event = (struct inotify_event *)at;
+                    at += sizeof(struct inotify_event) + event->len;
+                    Endpoint endpoint;
+                    if (event->len == 0 ||
+                        !ParseEndpoint(event->name, endpoint))
+                        continue;
+                    if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                        endpoint.status = Gone;
+                    } else {
+                        // sockets exist from the moment they are bound, a
+                        // bit before emulators listen on them: we leave it
+                        // to the caller to try again rather than block
+                        endpoint.status = Probe(endpoint.path) == Live
+                                              ? Live
+                                              : Created;
+                    }
+                    pending.push_back(std::move(endpoint));
+                }
+            }
         }
+
+        int inotify;                 /**< inotify instance. */
+        std::deque<Endpoint> pending; /**< Endpoints not returned yet. */
+    };
 #endif
-        // we allocate once buffers to not have to do mallocs for each IPC
-        // request, as malloc is expansive when we optimize for µs.
-        ret_buffer = new char[MAX_IPC_RETURN_SIZE];
-        ipc_buffer = new char[MAX_IPC_SIZE];
-        batch_arg_place = new unsigned int[MAX_BATCH_REPLY_COUNT];
-        InitSocket();
+
+    /**
+     * Sets how long commands of this session can take. @n
+     * Commands not done by then fail with Timeout, and their connection is
+     * closed: an emulator stuck mid-reply then only costs the timeout,
+     * instead of blocking every thread using the session. Connecting again
+     * is delayed as after a failed attempt.
+     * @param timeout_ms The timeout, in ms, -1 for none, the default.
+     * @see Deadline
+     * @see RECONNECT_MIN_DELAY
+     */
+    auto SetTimeout(int timeout_ms) -> void { timeout = timeout_ms; }
+
+    /**
+     * Deadline of the commands of the calling thread. @n
+     * Commands sent by the thread, with any session, while it is alive have
+     * to be done by then, or fail with Timeout as with SetTimeout. Nested
+     * deadlines can only shorten it.
+     * @see SetTimeout
+     */
+    class Deadline {
+      public:
+        /**
+         * Deadline Initializer.
+         * @param budget How long the commands can take, from now on.
+         */
+        Deadline(std::chrono::steady_clock::duration budget)
+            : previous(current) {
+            current = std::min(current,
+                               std::chrono::steady_clock::now() + budget);
+        }
+
+        ~Deadline() { current = previous; }
+
+        Deadline(const Deadline &rhs) = delete;
+        Deadline &operator=(const Deadline &rhs) = delete;
+
+        /**
+         * Deadline of the calling thread, if any.
+         */
+        static inline thread_local std::chrono::steady_clock::time_point
+            current = std::chrono::steady_clock::time_point::max();
+
+      private:
+        std::chrono::steady_clock::time_point previous;
+    };
+
+    /**
+     * Releases the connection of the calling thread. @n
+     * Only meaningful with ConnectionPool set. Threads release theirs when
+     * they exit, this is only needed to release it earlier. A batch being
+     * built on it is dropped.
+     * @see SessionFlags
+     */
+    auto ReleaseConnection() -> void {
+        if (!(flags & ConnectionPool))
+            return;
+        std::unique_ptr<Connection> conn;
+        {
+            std::lock_guard<std::mutex> lock(pool_blocking);
+            auto it = pool.find(std::this_thread::get_id());
+            if (it == pool.end())
+                return;
+            conn = std::move(it->second);
+            pool.erase(it);
+        }
+        if (conn_cache.session_id == session_id)
+            conn_cache = ConnectionCache{};
+        // we are the thread holding the locks of the batch
+        if (conn->batching) {
+            conn->batch_blocking.unlock();
+            conn->ipc_blocking.unlock();
+        }
     }
 
     /**
      * Shared Destructor.
      */
     virtual ~Shared() {
+        if (events.reader.joinable()) {
+            events.stopping = true;
+            events.reader.join();
+        }
+        if (flags & ConnectionPool) {
+            // waits for exiting threads to be done with our connections
+            std::lock_guard<std::mutex> lock(pooled_sessions_blocking);
+            pooled_sessions.erase(session_id);
+        }
+        delete connection;
+        pool.clear();
         // We clean up winsock.
 #ifdef _WIN32
         WSACleanup();
-#else
-        if (sock > -1) {
-            close_portable(sock);
-        }
 #endif
-        delete[] ret_buffer;
-        delete[] ipc_buffer;
-        delete[] batch_arg_place;
     }
 
     /**
@@ -1196,35 +3831,71 @@ class Shared {
 
 class PCSX2 : public Shared {
   public:
+    /**
+     * Name of the emulator, as found in the path of its socket.
+     */
+    static constexpr const char *EMULATOR_NAME = "pcsx2";
+
+    /**
+     * Slot the emulator listens on by default, which slot 0 stands for.
+     */
+    static constexpr unsigned int DEFAULT_SLOT = 28011;
+
     /**
      * PCSX2 session Initializer with a specified slot.
      * @param slot Slot to use for this IPC session.
+     * @param flags Session option flags, see Shared::SessionFlags.
      * @see slot
      */
-    PCSX2(const unsigned int slot = 0)
-        : Shared((slot == 0) ? 28011 : slot, "pcsx2", (slot == 0)) {}
+    PCSX2(const unsigned int slot = 0, const unsigned int flags = 0)
+        : Shared((slot == 0) ? DEFAULT_SLOT : slot, EMULATOR_NAME,
+                 (slot == 0), flags) {}
 };
 
 class RPCS3 : public Shared {
   public:
+    /**
+     * Name of the emulator, as found in the path of its socket.
+     */
+    static constexpr const char *EMULATOR_NAME = "rpcs3";
+
+    /**
+     * Slot the emulator listens on by default, which slot 0 stands for.
+     */
+    static constexpr unsigned int DEFAULT_SLOT = 28012;
+
     /**
      * RPCS3 session Initializer with a specified slot.
      * @param slot Slot to use for this IPC session.
+     * @param flags Session option flags, see Shared::SessionFlags.
      * @see slot
      */
-    RPCS3(const unsigned int slot = 0)
-        : Shared((slot == 0) ? 28012 : slot, "rpcs3", (slot == 0)) {}
+    RPCS3(const unsigned int slot = 0, const unsigned int flags = 0)
+        : Shared((slot == 0) ? DEFAULT_SLOT : slot, EMULATOR_NAME,
+                 (slot == 0), flags) {}
 };
 
 class DuckStation : public Shared {
   public:
+    /**
+     * Name of the emulator, as found in the path of its socket.
+     */
+    static constexpr const char *EMULATOR_NAME = "duckstation";
+
+    /**
+     * Slot the emulator listens on by default, which slot 0 stands for.
+     */
+    static constexpr unsigned int DEFAULT_SLOT = 28011;
+
     /**
      * DuckStation session Initializer with a specified slot.
      * @param slot Slot to use for this IPC session.
+     * @param flags Session option flags, see Shared::SessionFlags.
      * @see slot
      */
-    DuckStation(const unsigned int slot = 0)
-        : Shared((slot == 0) ? 28011 : slot, "duckstation", (slot == 0)) {}
+    DuckStation(const unsigned int slot = 0, const unsigned int flags = 0)
+        : Shared((slot == 0) ? DEFAULT_SLOT : slot, EMULATOR_NAME,
+                 (slot == 0), flags) {}
 
     auto GetGameVersion() {
         SetError(Unimplemented);
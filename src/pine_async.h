@@ -0,0 +1,730 @@
+#pragma once
+
+#include "pine.h"
+#include <algorithm>
+#include <bit>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <list>
+#include <optional>
+#include <utility>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+/**
+ * The PINE asynchronous API. @n
+ * C++20 coroutines on top of the client API: commands suspend the coroutine
+ * awaiting them instead of blocking the thread, an EventLoop resuming it once
+ * the emulator answered. A single thread can thus drive as many emulators as
+ * needed. @n
+ * Only available on Linux, as it relies on epoll.
+ */
+namespace PINE {
+
+#if defined(__linux__) || defined(DOXYGEN)
+
+template <typename T = void>
+class Task;
+
+/**
+ * Promise of a Task, the part shared by all of them.
+ * @see Task
+ */
+struct PromiseBase {
+    /**
+     * Coroutine to resume once the task is done.
+     */
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    /**
+     * Exception the task ended with, if any.
+     */
+    std::exception_ptr error;
+
+    /**
+     * Tasks left to finish before resuming the continuation, if it is
+     * awaiting multiple of them.
+     * @see EventLoop::All
+     */
+    unsigned int *pending = nullptr;
+
+    auto initial_suspend() noexcept -> std::suspend_always { return {}; }
+
+    /**
+     * Resumes the coroutine awaiting the task once it is done.
+     */
+    struct Resume {
+        PromiseBase *promise;
+
+        auto await_ready() noexcept -> bool { return false; }
+        auto await_suspend(std::coroutine_handle<>) noexcept
+            -> std::coroutine_handle<> {
+            if (promise->pending && --*promise->pending > 0)
+                return std::noop_coroutine();
+            return promise->continuation;
+        }
+        auto await_resume() noexcept -> void {}
+    };
+
+    auto final_suspend() noexcept -> Resume { return Resume{ this }; }
+
+    auto unhandled_exception() -> void { error = std::current_exception(); }
+};
+
+/**
+ * Promise of a Task returning a value.
+ * @see Task
+ */
+template <typename T>
+struct Promise : PromiseBase {
+    std::optional<T> value; /**< Value returned by the task. */
+
+    auto return_value(T v) -> void { value = std::move(v); }
+};
+
+/**
+ * Promise of a Task returning nothing.
+ * @see Task
+ */
+template <>
+struct Promise<void> : PromiseBase {
+    auto return_void() -> void {}
+};
+
+class EventLoop;
+
+/**
+ * A coroutine returning a T. @n
+ * Tasks only start once awaited, or handed to an EventLoop. Exceptions
+ * thrown in them, such as an IPCStatus, are rethrown to whoever awaits them.
+ * @see EventLoop
+ */
+template <typename T>
+class Task {
+    friend class EventLoop;
+
+  public:
+    struct promise_type : Promise<T> {
+        auto get_return_object() -> Task {
+            return Task{ std::coroutine_handle<promise_type>::from_promise(
+                *this) };
+        }
+    };
+
+    /**
+     * Starts the task and suspends the awaiting coroutine until it is done.
+     */
+    auto operator co_await() noexcept {
+        struct Awaiter {
+            std::coroutine_handle<promise_type> handle;
+
+            auto await_ready() noexcept -> bool { return false; }
+            auto await_suspend(std::coroutine_handle<> awaiting) noexcept
+                -> std::coroutine_handle<> {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+            auto await_resume() -> T { return Result(handle); }
+        };
+        return Awaiter{ handle };
+    }
+
+    Task(Task &&rhs) : handle(std::exchange(rhs.handle, nullptr)) {}
+    Task &operator=(Task &&rhs) {
+        if (handle)
+            handle.destroy();
+        handle = std::exchange(rhs.handle, nullptr);
+        return *this;
+    }
+    Task(const Task &rhs) = delete;
+    Task &operator=(const Task &rhs) = delete;
+
+    ~Task() {
+        if (handle)
+            handle.destroy();
+    }
+
+  private:
+    explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+
+    /**
+     * Returns the result of a finished task, or rethrows its exception.
+     */
+    static auto Result(std::coroutine_handle<promise_type> handle) -> T {
+        if (handle.promise().error)
+            std::rethrow_exception(handle.promise().error);
+        if constexpr (!std::is_void_v<T>)
+            return std::move(*handle.promise().value);
+    }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+/**
+ * Event loop driving Tasks. @n
+ * Coroutines waiting on a socket are resumed once epoll reports it ready.
+ * An EventLoop, and the tasks it drives, must only be used from the thread
+ * running it.
+ * @see Task
+ */
+class EventLoop {
+  public:
+    /**
+     * Suspends the awaiting coroutine until a file descriptor is ready.
+     * @see Wait
+     */
+    struct Readiness {
+        EventLoop &loop;                /**< Loop to wait on. */
+        int fd;                         /**< File descriptor to wait for. */
+        uint32_t events;                /**< epoll events to wait for. */
+        uint32_t revents = 0;           /**< epoll events that happened. */
+        std::coroutine_handle<> handle; /**< Coroutine waiting. */
+
+        auto await_ready() noexcept -> bool { return false; }
+        auto await_suspend(std::coroutine_handle<> h) -> void {
+            handle = h;
+            loop.Arm(*this);
+        }
+        auto await_resume() noexcept -> uint32_t { return revents; }
+    };
+
+    /**
+     * Waits for a file descriptor to be ready. @n
+     * Only one coroutine can wait on a given file descriptor at a time.
+     * @param fd The file descriptor.
+     * @param events The epoll events to wait for, eg EPOLLIN.
+     * @return An awaitable, returning the epoll events that happened.
+     */
+    auto Wait(int fd, uint32_t events) -> Readiness {
+        return Readiness{ *this, fd, events, 0, {} };
+    }
+
+    /**
+     * Resumes a coroutine on the next iteration of the loop.
+     * @param handle The coroutine to resume.
+     */
+    auto Post(std::coroutine_handle<> handle) -> void {
+        ready.push_back(handle);
+    }
+
+    /**
+     * Runs a task in the background, until Run returns.
+     * @param task The task to run.
+     * @see Run
+     */
+    auto Spawn(Task<void> task) -> void {
+        Post(task.handle);
+        spawned.push_back(std::move(task));
+    }
+
+    /**
+     * Runs tasks concurrently.
+     * @param tasks The tasks to run.
+     * @return An awaitable, resuming the awaiting coroutine once all of them
+     * are done, and rethrowing the exception of the first one that failed,
+     * if any.
+     */
+    auto All(std::vector<Task<void>> tasks) {
+        struct Awaiter {
+            EventLoop &loop;
+            std::vector<Task<void>> tasks;
+            unsigned int pending;
+
+            auto await_ready() noexcept -> bool { return tasks.empty(); }
+            auto await_suspend(std::coroutine_handle<> awaiting) -> void {
+                for (auto &task : tasks) {
+                    task.handle.promise().continuation = awaiting;
+                    task.handle.promise().pending = &pending;
+                    loop.Post(task.handle);
+                }
+            }
+            auto await_resume() -> void {
+                for (auto &task : tasks)
+                    Task<void>::Result(task.handle);
+            }
+        };
+        unsigned int count = tasks.size();
+        return Awaiter{ *this, std::move(tasks), count };
+    }
+
+    /**
+     * Runs the loop until every spawned task is done. @n
+     * Rethrows the exception of the first one that failed, if any.
+     * @see Spawn
+     */
+    auto Run() -> void {
+        Drive([this]() {
+            return std::all_of(spawned.begin(), spawned.end(),
+                               [](auto &task) { return task.handle.done(); });
+        });
+        std::list<Task<void>> done;
+        done.swap(spawned);
+        for (auto &task : done) {
+            if (!task.handle.done())
+                throw Shared::Unknown;
+            Task<void>::Result(task.handle);
+        }
+    }
+
+    /**
+     * Runs the loop until a task is done, background ones included.
+     * @param task The task to run.
+     * @return What the task returned, or rethrows its exception.
+     */
+    template <typename T>
+    auto Run(Task<T> task) -> T {
+        Post(task.handle);
+        Drive([&task]() { return task.handle.done(); });
+        // nothing is left to resume it
+        if (!task.handle.done())
+            throw Shared::Unknown;
+        return Task<T>::Result(task.handle);
+    }
+
+    EventLoop() { epoll = epoll_create1(EPOLL_CLOEXEC); }
+
+    ~EventLoop() { close(epoll); }
+
+    EventLoop(const EventLoop &rhs) = delete;
+    EventLoop &operator=(const EventLoop &rhs) = delete;
+
+  private:
+    /**
+     * Registers a coroutine waiting on a file descriptor. @n
+     * File descriptors stay registered with epoll, which drops them once
+     * closed, and are only rearmed by the next waits.
+     */
+    auto Arm(Readiness &waiter) -> void {
+        struct epoll_event event = {};
+        event.events = waiter.events | EPOLLONESHOT;
+        event.data.ptr = &waiter;
+        if (epoll_ctl(epoll, EPOLL_CTL_MOD, waiter.fd, &event) < 0 &&
+            (errno != ENOENT ||
+             epoll_ctl(epoll, EPOLL_CTL_ADD, waiter.fd, &event) < 0)) {
+            // let the waiter find out about it
+            waiter.revents = EPOLLERR;
+            Post(waiter.handle);
+            return;
+        }
+        waiting += 1;
+    }
+
+    /**
+     * Resumes coroutines as they get ready until done returns true, or
+     * nothing is left to wait for.
+     */
+    template <typename F>
+    auto Drive(F &&done) -> void {
+        struct epoll_event events[64];
+        while (!done()) {
+            if (!ready.empty()) {
+                auto handle = ready.front();
+                ready.pop_front();
+                handle.resume();
+                continue;
+            }
+            if (waiting == 0)
+                return;
+            int count = epoll_wait(epoll, events, 64, -1);
+            for (int i = 0; i < count; i++) {
+                Readiness *waiter = (Readiness *)events[i].data.ptr;
+                waiter->revents = events[i].events;
+                waiting -= 1;
+                ready.push_back(waiter->handle);
+            }
+        }
+    }
+
+    int epoll;                                 /**< epoll instance. */
+    unsigned int waiting = 0;                  /**< Coroutines in epoll. */
+    std::deque<std::coroutine_handle<>> ready; /**< Coroutines to resume. */
+    std::list<Task<void>> spawned;             /**< Background tasks. */
+};
+
+/**
+ * Coroutines taking turns on a connection. @n
+ * Commands are exchanged one at a time, in the order they were awaited.
+ */
+class TurnQueue {
+  public:
+    /**
+     * Exclusive use of the connection, until destroyed.
+     * @see Acquire
+     */
+    struct Turn {
+        TurnQueue *queue;
+
+        Turn(TurnQueue *q) : queue(q) {}
+        Turn(Turn &&rhs) : queue(std::exchange(rhs.queue, nullptr)) {}
+        ~Turn() {
+            if (queue)
+                queue->Release();
+        }
+    };
+
+    /**
+     * Waits for the turn of the awaiting coroutine.
+     * @return An awaitable, returning the Turn.
+     */
+    auto Acquire() {
+        struct Awaiter {
+            TurnQueue &queue;
+
+            auto await_ready() noexcept -> bool {
+                if (queue.busy)
+                    return false;
+                queue.busy = true;
+                return true;
+            }
+            auto await_suspend(std::coroutine_handle<> handle) -> void {
+                queue.waiting.push_back(handle);
+            }
+            auto await_resume() -> Turn { return Turn{ &queue }; }
+        };
+        return Awaiter{ *this };
+    }
+
+    TurnQueue(EventLoop &loop) : loop(loop) {}
+
+  private:
+    /**
+     * Hands the connection over to the next coroutine waiting for it.
+     */
+    auto Release() -> void {
+        if (waiting.empty()) {
+            busy = false;
+            return;
+        }
+        loop.Post(waiting.front());
+        waiting.pop_front();
+    }
+
+    EventLoop &loop;
+    bool busy = false; /**< Whether a coroutine has its turn. */
+    std::deque<std::coroutine_handle<>> waiting; /**< Coroutines waiting. */
+};
+
+/**
+ * Asynchronous session with an emulator. @n
+ * Read, Write and Send return Tasks, suspending instead of blocking; batches
+ * are built as usual, with the batch variants of the emulator class E, and
+ * their replies read with GetReply. @n
+ * Commands of a session are sent one at a time, in the order they were
+ * awaited: concurrency comes from driving many sessions from the same loop.
+ * A session must not be used from other threads, nor with the blocking
+ * SendCommand, Submit or Complete, while the loop runs.
+ * @see EventLoop
+ */
+template <typename E>
+class Async : public E {
+  protected:
+    using IPCBuffer = Shared::IPCBuffer;
+    using Connection = Shared::Connection;
+
+    /**
+     * Loop driving the session.
+     */
+    EventLoop &loop;
+
+    /**
+     * Coroutines taking turns on the connection of the session.
+     */
+    TurnQueue turns;
+
+    /**
+     * Reads whatever the emulator sent, without blocking, into the
+     * read-ahead buffer of a connection.
+     * @return false if the connection was lost, true otherwise, even if
+     * nothing was read.
+     */
+    auto ReadAhead(Connection &c) -> bool {
+        char chunk[65536];
+        auto length = recv(c.sock, chunk, sizeof(chunk), MSG_DONTWAIT);
+        if (length > 0) {
+            c.read_ahead.insert(c.read_ahead.end(), chunk, chunk + length);
+            return true;
+        }
+        return length < 0 && would_block_portable();
+    }
+
+    /**
+     * Writes an IPC message to the socket of a connection. @n
+     * Connects first if needed. As WriteCommand, reads replies while the
+     * socket is full.
+     * @param c The connection to write to.
+     * @param command The IPC message, or multiple of them back to back.
+     */
+    auto SendMessage(Connection &c, IPCBuffer command) -> Task<void> {
+        if (!c.sock_state)
+            this->InitSocket(c);
+        int sent = 0;
+        while (c.sock_state && sent < command.size) {
+            auto length = write_nonblock_portable(
+                c.sock, &command.buffer[sent], command.size - sent);
+            if (length >= 0) {
+                sent += length;
+                continue;
+            }
+            if (!would_block_portable())
+                break;
+            uint32_t ready = co_await loop.Wait(c.sock, EPOLLIN | EPOLLOUT);
+            if (((ready & EPOLLIN) && !ReadAhead(c)) ||
+                (!(ready & (EPOLLIN | EPOLLOUT)) &&
+                 (ready & (EPOLLERR | EPOLLHUP))))
+                break;
+        }
+        if (sent < command.size) {
+            this->CloseSocket(c);
+            this->SetError(Shared::NoConnection);
+        }
+    }
+
+    /**
+     * Waits for the read-ahead buffer of a connection to hold a number of
+     * replies, which can then be read without blocking.
+     * @param c The connection to read from.
+     * @param count The number of replies.
+     */
+    auto ReceiveReplies(Connection &c, unsigned int count) -> Task<void> {
+        size_t at = 0;
+        while (count > 0) {
+            if (c.read_ahead.size() - at >= 4) {
+                uint32_t size = Shared::FromArray<uint32_t>(c.read_ahead.data(),
+                                                            at);
+                // ReadReply is the one failing on invalid replies
+                if (size < 5 || size > MAX_IPC_SIZE)
+                    co_return;
+                if (c.read_ahead.size() - at >= size) {
+                    at += size;
+                    count -= 1;
+                    continue;
+                }
+            }
+            size_t held = c.read_ahead.size();
+            if (!ReadAhead(c)) {
+                this->CloseSocket(c);
+                this->SetError(Shared::NoConnection);
+                co_return;
+            }
+            if (c.read_ahead.size() == held)
+                co_await loop.Wait(c.sock, EPOLLIN);
+        }
+    }
+
+    /**
+     * Sends an IPC message and reads its reply.
+     * @param cmd The IPC message.
+     * @param ret The buffer to read its reply into.
+     */
+    auto Exchange(IPCBuffer cmd, IPCBuffer ret) -> Task<void> {
+        auto turn = co_await turns.Acquire();
+        Connection &c = this->Conn();
+        co_await SendMessage(c, cmd);
+        co_await ReceiveReplies(c, 1);
+        Shared::IPCStatus status = this->ReadReply(c, ret);
+        if (status != Shared::Success)
+            this->SetError(status);
+    }
+
+    template <typename Y>
+    auto ReadAsync(uint32_t address) -> Task<Y> {
+        static_assert(std::has_single_bit(sizeof(Y)) && sizeof(Y) <= 8,
+                      "only 8, 16, 32 and 64 bit values can be read");
+        constexpr auto tag = (Shared::IPCCommand)(Shared::MsgRead8 +
+                                                  std::countr_zero(sizeof(Y)));
+        char cmd[4 + 5];
+        char ret[4 + 1 + sizeof(Y)];
+        this->FormatBeginning(cmd, address, tag, sizeof(cmd));
+        co_await Exchange(IPCBuffer{ sizeof(cmd), cmd },
+                          IPCBuffer{ sizeof(ret), ret });
+        co_return this->template GetReply<tag>((char *)ret, 5);
+    }
+
+    template <typename Y>
+    auto WriteAsync(uint32_t address, Y value) -> Task<void> {
+        static_assert(std::has_single_bit(sizeof(Y)) && sizeof(Y) <= 8,
+                      "only 8, 16, 32 and 64 bit values can be written");
+        constexpr auto tag = (Shared::IPCCommand)(Shared::MsgWrite8 +
+                                                  std::countr_zero(sizeof(Y)));
+        char cmd[4 + 5 + sizeof(Y)];
+        char ret[4 + 1];
+        Shared::ToArray(this->FormatBeginning(cmd, address, tag, sizeof(cmd)),
+                        value, 4 + 5);
+        co_await Exchange(IPCBuffer{ sizeof(cmd), cmd },
+                          IPCBuffer{ sizeof(ret), ret });
+    }
+
+  public:
+    /**
+     * Reads a value from the emulator's memory. @n
+     * Awaiting it throws an IPCStatus on error.
+     * @param address The address to read.
+     * @param T Flag to enable batch processing or not.
+     * @param Y The type of the variable to read (eg uint8_t).
+     * @return A Task returning the value read. If in batch mode the IPC
+     * message, as with Shared::Read.
+     * @see Shared::Read
+     */
+    template <typename Y, bool T = false>
+    auto Read(uint32_t address) {
+        if constexpr (T)
+            return E::template Read<Y, true>(address);
+        else
+            return ReadAsync<Y>(address);
+    }
+
+    /**
+     * Writes a value to the emulator's memory. @n
+     * Awaiting it throws an IPCStatus on error.
+     * @param address The address to write to.
+     * @param value The value to write.
+     * @param slot In batch mode, as with Shared::Write.
+     * @param T Flag to enable batch processing or not.
+     * @param Y The type of the variable to write (eg uint8_t).
+     * @return A Task. If in batch mode the IPC message, as with
+     * Shared::Write.
+     * @see Shared::Write
+     */
+    template <typename Y, bool T = false>
+    auto Write(uint32_t address, Y value,
+               [[maybe_unused]] Shared::BatchSlot<Y> *slot = nullptr) {
+        if constexpr (T)
+            return E::template Write<Y, true>(address, value, slot);
+        else
+            return WriteAsync<Y>(address, value);
+    }
+
+    /**
+     * Sends a batch command. @n
+     * Awaiting it throws an IPCStatus on error. The BatchCommand must stay
+     * alive until then, its replies can then be read with GetReply.
+     * @param cmd The BatchCommand to send.
+     * @return A Task.
+     * @see Shared::SendCommand
+     */
+    auto Send(const Shared::BatchCommand &cmd) -> Task<void> {
+        auto turn = co_await turns.Acquire();
+        Connection &c = this->Conn();
+        co_await SendMessage(c, cmd.ipc_message);
+        co_await ReceiveReplies(c, cmd.frames);
+        Shared::IPCStatus status = this->ReadBatchReply(c, cmd);
+        if (status != Shared::Success)
+            this->SetError(status);
+    }
+
+    /**
+     * Async Initializer.
+     * @param loop The loop driving the session.
+     * @param slot Slot to use for this IPC session, as with E.
+     */
+    Async(EventLoop &loop, const unsigned int slot = 0)
+        : E(slot), loop(loop), turns(loop) {}
+};
+
+/**
+ * Asynchronous session with many instances of an emulator at once. @n
+ * Batches are built once, with the batch variants of the emulator class E,
+ * and sent to every instance concurrently by Broadcast, each getting its own
+ * copy of the replies. Instances only cost a socket and their replies: the
+ * buffers building batches are those of the session, which otherwise is an
+ * Async session with the first slot.
+ * @see Async
+ */
+template <typename E>
+class Fleet : public Async<E> {
+  public:
+    /**
+     * Reply of an instance to a Broadcast.
+     */
+    struct Result {
+        unsigned int slot;         /**< Slot of the instance. */
+        Shared::IPCStatus status;  /**< Status of the batch command. */
+        Shared::BatchCommand reply; /**< Replies, to read with GetReply. */
+    };
+
+  protected:
+    using Connection = Shared::Connection;
+
+    /**
+     * An emulator instance of the fleet.
+     */
+    struct Instance {
+        unsigned int slot;        /**< Slot of the instance. */
+        Connection conn{ false }; /**< Its connection, without buffers. */
+        TurnQueue turns;          /**< Coroutines taking turns on conn. */
+
+        Instance(EventLoop &loop, unsigned int s) : slot(s), turns(loop) {}
+    };
+
+    /**
+     * Instances of the fleet, in the order of their slots.
+     */
+    std::vector<std::unique_ptr<Instance>> instances;
+
+    /**
+     * Sends a batch command to an instance.
+     * @param instance The instance.
+     * @param cmd The BatchCommand to send.
+     * @param result Where to store the outcome, its reply being a copy of
+     * cmd.
+     */
+    auto SendTo(Instance &instance, const Shared::BatchCommand &cmd,
+                Result &result) -> Task<void> {
+        auto turn = co_await instance.turns.Acquire();
+        Connection &c = instance.conn;
+        try {
+            co_await this->SendMessage(c, cmd.ipc_message);
+            co_await this->ReceiveReplies(c, cmd.frames);
+            result.status = this->ReadBatchReply(c, result.reply);
+        } catch (Shared::IPCStatus status) {
+            result.status = status;
+        }
+    }
+
+  public:
+    /**
+     * Sends a batch command to every instance. @n
+     * Instances are connected to on first use, and reconnected to on the
+     * next Broadcast if lost. The BatchCommand must stay alive until the
+     * task is done.
+     * @param cmd The BatchCommand to send.
+     * @return A Task returning one Result per instance, in the order of
+     * their slots. Errors are reported there instead of thrown.
+     */
+    auto Broadcast(const Shared::BatchCommand &cmd)
+        -> Task<std::vector<Result>> {
+        std::vector<Result> results;
+        results.reserve(instances.size());
+        std::vector<Task<void>> sends;
+        for (auto &instance : instances) {
+            results.push_back(
+                Result{ instance->slot, Shared::Success, cmd.Clone(false) });
+            sends.push_back(SendTo(*instance, cmd, results.back()));
+        }
+        co_await this->loop.All(std::move(sends));
+        co_return results;
+    }
+
+    /**
+     * Fleet Initializer.
+     * @param loop The loop driving the session.
+     * @param slots Slots of the instances, as with E.
+     */
+    Fleet(EventLoop &loop, const std::vector<unsigned int> &slots)
+        : Async<E>(loop, slots.empty() ? 0 : slots[0]) {
+        for (unsigned int slot : slots) {
+            auto instance = std::make_unique<Instance>(loop, slot);
+            instance->conn.path =
+                E::SocketPath((slot == 0) ? E::DEFAULT_SLOT : slot,
+                              E::EMULATOR_NAME, (slot == 0));
+            instances.push_back(std::move(instance));
+        }
+    }
+};
+
+#endif
+
+}; // namespace PINE
@@ -0,0 +1,307 @@
+#pragma once
+
+#include "pine.h"
+#include <algorithm>
+#include <vector>
+
+/**
+ * Size of the pages the MemoryMirror mirrors memory in.
+ * @see MemoryMirror
+ */
+#define MIRROR_PAGE_SIZE 4096
+
+namespace PINE {
+
+/**
+ * Client-side mirror of parts of the emulator's memory. @n
+ * Configured ranges are mirrored in pages, all of them refreshed by a single
+ * batch command per Refresh, typically once per frame. Reads of mirrored
+ * addresses are then served locally, others going to the emulator as
+ * usual; writes go to the emulator and update the mirror. @n
+ * A mirror is not thread safe, and sees what the emulator memory was at the
+ * last Refresh: writes made by others, or by the game, only show up on the
+ * next one.
+ * @see Shared
+ */
+class MemoryMirror {
+  protected:
+    /**
+     * A run of contiguous mirrored pages.
+     */
+    struct Block {
+        uint32_t start;         /**< First address of the block. */
+        uint32_t end;           /**< Address right past the block. */
+        std::vector<char> data; /**< Its contents as of the last Refresh. */
+    };
+
+    /**
+     * Session to mirror the memory of.
+     */
+    Shared &ipc;
+
+    /**
+     * Mirrored blocks, sorted by address and never adjacent.
+     */
+    std::vector<Block> blocks;
+
+    /**
+     * Block the last lookup found, tried first by the next one: reads
+     * tend to hit the same block over and over.
+     */
+    size_t last = 0;
+
+    /**
+     * Whether the mirrored blocks hold the memory of the last Refresh.
+     * @see Invalidate
+     */
+    bool valid = false;
+
+    /**
+     * Number of Refresh so far.
+     */
+    uint64_t epoch = 0;
+
+    /**
+     * Most a read of the refreshing batch command reads, as each has to fit
+     * in a reply of its own.
+     */
+    static constexpr uint32_t chunk =
+        (MAX_IPC_RETURN_SIZE - 4 - 1) / MIRROR_PAGE_SIZE * MIRROR_PAGE_SIZE;
+
+    /**
+     * Batch command refreshing every block, built on first use.
+     */
+    Shared::BatchCommand batch;
+
+    /**
+     * Whether batch is built, and whether it waits for the end of a frame.
+     */
+    bool built = false, built_frame_end = false;
+
+    /**
+     * Returns where a mirrored span of memory is stored.
+     * @param address The start of the span.
+     * @param length Its length.
+     * @return nullptr if not fully mirrored.
+     */
+    auto Find(uint32_t address, uint32_t length) -> char * {
+        auto holds = [&](const Block &block) {
+            return address >= block.start &&
+                   (uint64_t)address + length <= block.end;
+        };
+        if (last < blocks.size() && holds(blocks[last]))
+            return &blocks[last].data[address - blocks[last].start];
+        auto it = std::upper_bound(
+            blocks.begin(), blocks.end(), address,
+            [](uint32_t a, const Block &block) { return a < block.start; });
+        if (it == blocks.begin() || !holds(*--it))
+            return nullptr;
+        last = it - blocks.begin();
+        return &it->data[address - it->start];
+    }
+
+    /**
+     * Copies a span of memory written to the emulator into the mirror,
+     * where mirrored.
+     * @param address The start of the span.
+     * @param src Its contents.
+     * @param length Its length.
+     */
+    auto Update(uint32_t address, const char *src, uint32_t length) -> void {
+        for (Block &block : blocks) {
+            uint32_t start = std::max(address, block.start);
+            uint32_t end = std::min<uint64_t>((uint64_t)address + length,
+                                              block.end);
+            if (start < end)
+                memcpy(&block.data[start - block.start],
+                       &src[start - address], end - start);
+        }
+    }
+
+    /**
+     * Builds the batch command refreshing every block.
+     * @param frame_end Whether to read them at the end of a frame.
+     */
+    auto Build(bool frame_end) -> void {
+        ipc.InitializeBatch();
+        if (frame_end)
+            ipc.ExecuteOnFrameEnd<true>();
+        for (const Block &block : blocks)
+            for (uint32_t at = block.start; at < block.end; at += chunk)
+                ipc.ReadRange<true>(at, std::min(chunk, block.end - at));
+        batch = ipc.FinalizeBatch();
+        built = true;
+        built_frame_end = frame_end;
+    }
+
+  public:
+    /**
+     * Mirrors a range of the emulator's memory. @n
+     * The range is extended to whole pages. It is only served locally
+     * once refreshed.
+     * @param address The start of the range.
+     * @param length Its length.
+     * @see Refresh
+     */
+    auto Mirror(uint32_t address, uint32_t length) -> void {
+        if (length == 0)
+            return;
+        uint64_t start = address / MIRROR_PAGE_SIZE * MIRROR_PAGE_SIZE;
+        uint64_t end = ((uint64_t)address + length + MIRROR_PAGE_SIZE - 1) /
+                       MIRROR_PAGE_SIZE * MIRROR_PAGE_SIZE;
+        end = std::min<uint64_t>(end, UINT32_MAX / MIRROR_PAGE_SIZE *
+                                          MIRROR_PAGE_SIZE);
+
+        // merge it with the blocks it touches, which keeps them sorted and
+        // apart from each other
+        std::vector<Block> merged;
+        Block range = Block{ (uint32_t)start, (uint32_t)end, {} };
+        for (Block &block : blocks) {
+            if (block.end < range.start || block.start > range.end)
+                merged.push_back(std::move(block));
+            else {
+                range.start = std::min(range.start, block.start);
+                range.end = std::max(range.end, block.end);
+            }
+        }
+        range.data.resize(range.end - range.start);
+        merged.insert(std::upper_bound(merged.begin(), merged.end(), range,
+                                       [](const Block &a, const Block &b) {
+                                           return a.start < b.start;
+                                       }),
+                      std::move(range));
+        blocks = std::move(merged);
+        last = 0;
+        built = false;
+        valid = false;
+    }
+
+    /**
+     * Refreshes every mirrored range, with a single batch command. @n
+     * On error throws an IPCStatus, the mirror being invalidated.
+     * @param frame_end Whether to read them at the end of the next frame,
+     * for a consistent snapshot of it. Only holds for mirrors small enough
+     * for the batch to fit a single IPC message.
+     * @return The new epoch of the mirror.
+     * @see Shared::ExecuteOnFrameEnd
+     */
+    auto Refresh(bool frame_end = false) -> uint64_t {
+        if (blocks.empty())
+            return ++epoch;
+        if (!built || built_frame_end != frame_end)
+            Build(frame_end);
+        valid = false;
+        ipc.SendCommand(batch);
+#ifdef C_FFI
+        if (ipc.GetError() != Shared::Success)
+            return epoch;
+#endif
+        unsigned int reply = frame_end ? 1 : 0;
+        for (Block &block : blocks) {
+            for (uint32_t at = 0; at < block.data.size(); at += chunk) {
+                memcpy(&block.data[at],
+                       ipc.GetReply<Shared::MsgReadRange>(batch, reply++),
+                       std::min<uint32_t>(chunk, block.data.size() - at));
+            }
+        }
+        valid = true;
+        return ++epoch;
+    }
+
+    /**
+     * Stops serving reads locally until the next Refresh, eg after loading
+     * a savestate.
+     */
+    auto Invalidate() -> void { valid = false; }
+
+    /**
+     * Returns the number of Refresh so far.
+     */
+    auto Epoch() const -> uint64_t { return epoch; }
+
+    /**
+     * Reads a value, from the mirror if it is mirrored. @n
+     * On error throws an IPCStatus.
+     * @param address The address to read.
+     * @param Y The type of the variable to read (eg uint8_t).
+     * @return The value read.
+     * @see Shared::Read
+     */
+    template <typename Y>
+    auto Read(uint32_t address) -> Y {
+        if (valid) {
+            if (const char *src = Find(address, sizeof(Y))) {
+                Y value;
+                memcpy(&value, src, sizeof(Y));
+                return value;
+            }
+        }
+        return ipc.Read<Y>(address);
+    }
+
+    /**
+     * Reads a contiguous block, from the mirror if it is mirrored. @n
+     * On error throws an IPCStatus.
+     * @param address The address to start reading at.
+     * @param length The number of bytes to read.
+     * @param dst Where to copy the block to.
+     * @see Shared::ReadRange
+     */
+    auto ReadRange(uint32_t address, uint32_t length, void *dst) -> void {
+        if (valid) {
+            if (const char *src = Find(address, length)) {
+                memcpy(dst, src, length);
+                return;
+            }
+        }
+        ipc.ReadRange(address, length, dst);
+    }
+
+    /**
+     * Writes a value to the emulator, and to the mirror. @n
+     * On error throws an IPCStatus.
+     * @param address The address to write to.
+     * @param value The value to write.
+     * @param Y The type of the variable to write (eg uint8_t).
+     * @see Shared::Write
+     */
+    template <typename Y>
+    auto Write(uint32_t address, Y value) -> void {
+        ipc.Write<Y>(address, value);
+#ifdef C_FFI
+        if (ipc.GetError() != Shared::Success)
+            return;
+#endif
+        Update(address, (const char *)&value, sizeof(Y));
+    }
+
+    /**
+     * Writes a contiguous block to the emulator, and to the mirror. @n
+     * On error throws an IPCStatus.
+     * @param address The address to start writing at.
+     * @param src The block to write.
+     * @param length The number of bytes to write.
+     * @see Shared::WriteRange
+     */
+    auto WriteRange(uint32_t address, const void *src, uint32_t length)
+        -> void {
+        ipc.WriteRange(address, src, length);
+#ifdef C_FFI
+        if (ipc.GetError() != Shared::Success)
+            return;
+#endif
+        Update(address, (const char *)src, length);
+    }
+
+    /**
+     * MemoryMirror Initializer.
+     * @param ipc The session to mirror the memory of, which has to outlive
+     * the mirror.
+     */
+    MemoryMirror(Shared &ipc) : ipc(ipc) {}
+
+    MemoryMirror(const MemoryMirror &rhs) = delete;
+    MemoryMirror &operator=(const MemoryMirror &rhs) = delete;
+};
+
+}; // namespace PINE
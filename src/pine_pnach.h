@@ -0,0 +1,469 @@
+#pragma once
+
+#include "pine.h"
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <istream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * How long the PnachRunner waits between two applications of its cheats when
+ * not synchronized to frames, in ms: about one frame at 60fps.
+ * @see PnachRunner
+ */
+#define PNACH_PERIOD 16
+
+namespace PINE {
+
+/**
+ * A pnach cheat file, compiled into batch commands. @n
+ * Plain writes (byte, short, word, double) and the extended codes below are
+ * supported, on the EE: @n
+ * * 0, 1, 2: 8, 16 and 32 bit writes. @n
+ * * 3: 8, 16 and 32 bit increments and decrements, as MsgModify. @n
+ * * 4: serial 32 bit writes. @n
+ * * 7: 8 and 16 bit ors, ands and xors, as MsgModify. @n
+ * * C: 32 bit test guarding all the following codes, as a MsgIf. @n
+ * * E: 8 and 16 bit tests guarding the next lines, as a MsgIf. @n
+ * Other codes, eg copies or pointer writes, are counted as unsupported and
+ * ignored. @n
+ * Adjacent writes are merged into bigger ones where alignment allows, a
+ * whole file taking a single batch command to apply.
+ * @see PnachRunner
+ */
+class Pnach {
+  protected:
+    /**
+     * A code, once parsed.
+     */
+    struct Code {
+        /**
+         * What the code does.
+         */
+        enum Kind : unsigned char {
+            Write = 0,  /**< Writes value. */
+            Modify = 1, /**< Applies op, a ModifyOp, with value. */
+            If = 2,     /**< Begins a block, op being its Condition. */
+            End = 3     /**< Ends the last block. */
+        } kind;
+        bool once;        /**< Whether to apply it once only, at boot. */
+        uint32_t address; /**< The address of its value. */
+        uint8_t size;     /**< The size of its value. */
+        uint8_t op;       /**< Its operation, if any. */
+        uint64_t value;   /**< Its operand. */
+    };
+
+    /**
+     * Codes of the file, in order.
+     */
+    std::vector<Code> codes;
+
+    /**
+     * Number of patch lines that could not be compiled.
+     */
+    unsigned int unsupported = 0;
+
+    /**
+     * Calls a function with a value of the unsigned integer type of a size.
+     * @param size The size, 1, 2, 4 or 8.
+     * @param f The function, taking the value.
+     */
+    template <typename F>
+    static auto BySize(unsigned int size, F f) -> void {
+        switch (size) {
+            case 1:
+                f(uint8_t());
+                break;
+            case 2:
+                f(uint16_t());
+                break;
+            case 4:
+                f(uint32_t());
+                break;
+            case 8:
+                f(uint64_t());
+                break;
+        }
+    }
+
+    /**
+     * Adds the pending writes to the batch being built, merging the
+     * contiguous ones: long runs into a single WriteRange, short ones into
+     * as few naturally aligned writes as possible.
+     * @param ipc The session building the batch.
+     * @param writes The bytes to write, by address. Cleared.
+     */
+    static auto Flush(Shared &ipc, std::map<uint32_t, uint8_t> &writes)
+        -> void {
+        std::vector<char> run;
+        for (auto it = writes.begin(); it != writes.end();) {
+            uint32_t start = it->first;
+            run.clear();
+            for (; it != writes.end() && it->first == start + run.size(); ++it)
+                run.push_back(it->second);
+            if (run.size() >= 16) {
+                ipc.WriteRange<true>(start, run.data(), run.size());
+                continue;
+            }
+            for (uint32_t at = 0; at < run.size();) {
+                uint32_t address = start + at;
+                uint32_t size = 8;
+                while (address % size || at + size > run.size())
+                    size /= 2;
+                BySize(size, [&](auto type) {
+                    decltype(type) value;
+                    memcpy(&value, &run[at], size);
+                    ipc.Write<decltype(type), true>(address, value);
+                });
+                at += size;
+            }
+        }
+        writes.clear();
+    }
+
+    /**
+     * Parses the code of an extended patch line.
+     * @param address The address field of the line.
+     * @param value The value field of the line.
+     * @param once Whether the line is applied once only.
+     * @param second The address and value fields of the next patch line,
+     * for the codes spanning two lines, nullptr if there is none.
+     * @param two Set if the code spans the next line.
+     * @return The number of lines the code guards, if it is a test, 0
+     * otherwise, -1 if it is unsupported.
+     */
+    auto Extended(uint32_t address, uint32_t value, bool once,
+                  const std::pair<uint32_t, uint32_t> *second, bool &two)
+        -> long {
+        uint32_t target = address & 0x0FFFFFFF;
+        auto push = [&](Code::Kind kind, uint32_t address, uint8_t size,
+                        uint8_t op, uint64_t value) {
+            codes.push_back(Code{ kind, once, address, size, op, value });
+        };
+        switch (address >> 28) {
+            case 0x0:
+                push(Code::Write, target, 1, 0, value & 0xFF);
+                return 0;
+            case 0x1:
+                push(Code::Write, target, 2, 0, value & 0xFFFF);
+                return 0;
+            case 0x2:
+                push(Code::Write, target, 4, 0, value);
+                return 0;
+            case 0x3: {
+                // 30t0nnnn aaaaaaaa, the 32 bit ones taking their operand
+                // from the next line
+                unsigned int type = (address >> 20) & 0xF;
+                uint32_t at = value & 0x0FFFFFFF;
+                auto op = type % 2 ? Shared::Sub : Shared::Add;
+                if (type < 2)
+                    push(Code::Modify, at, 1, op, address & 0xFF);
+                else if (type < 4)
+                    push(Code::Modify, at, 2, op, address & 0xFFFF);
+                else if (type < 6 && second) {
+                    push(Code::Modify, at, 4, op, second->first);
+                    two = true;
+                } else
+                    return -1;
+                return 0;
+            }
+            case 0x4: {
+                // 4aaaaaaa nnnnssss, vvvvvvvv iiiiiiii
+                if (!second)
+                    return -1;
+                uint32_t count = value >> 16, step = (value & 0xFFFF) * 4;
+                for (uint32_t i = 0; i < count; i++)
+                    push(Code::Write, target + i * step, 4, 0,
+                         (uint32_t)(second->first + i * second->second));
+                two = true;
+                return 0;
+            }
+            case 0x7: {
+                // 7aaaaaaa 00t0vvvv
+                static constexpr Shared::ModifyOp ops[] = { Shared::Or,
+                                                            Shared::And,
+                                                            Shared::Xor };
+                unsigned int type = (value >> 20) & 0xF;
+                if (type > 5)
+                    return -1;
+                push(Code::Modify, target, type % 2 ? 2 : 1, ops[type / 2],
+                     type % 2 ? value & 0xFFFF : value & 0xFF);
+                return 0;
+            }
+            case 0xC:
+                // Caaaaaaa vvvvvvvv, guarding everything that follows
+                push(Code::If, target, 4, Shared::Equal, value);
+                return LONG_MAX;
+            case 0xE: {
+                // Etnnvvvv taaaaaaa, t being the size then the condition
+                static constexpr Shared::Condition conditions[] = {
+                    Shared::Equal, Shared::NotEqual, Shared::Less,
+                    Shared::Greater
+                };
+                unsigned int condition = value >> 28;
+                if (condition > 3)
+                    return -1;
+                bool byte = (address >> 24) & 0xF;
+                push(Code::If, value & 0x0FFFFFFF, byte ? 1 : 2,
+                     conditions[condition],
+                     byte ? address & 0xFF : address & 0xFFFF);
+                return (address >> 16) & 0xFF;
+            }
+            default:
+                return -1;
+        }
+    }
+
+  public:
+    /**
+     * Compiles the codes of the file into a batch command. @n
+     * On error throws an IPCStatus.
+     * @param ipc The session to build the batch command with.
+     * @param once Whether to compile the codes applied once at boot, rather
+     * than the ones applied continuously.
+     * @param frame_end Whether to apply them at the end of a frame.
+     * @return The batch command, to send as many times as needed.
+     * @see Shared::ExecuteOnFrameEnd
+     */
+    auto Compile(Shared &ipc, bool once = false, bool frame_end = false)
+        -> Shared::BatchCommand {
+        ipc.InitializeBatch();
+        try {
+            if (frame_end)
+                ipc.ExecuteOnFrameEnd<true>();
+            std::map<uint32_t, uint8_t> writes;
+            for (const Code &code : codes) {
+                if (code.once != once)
+                    continue;
+                if (code.kind == Code::Write) {
+                    for (unsigned int i = 0; i < code.size; i++)
+                        writes[code.address + i] = code.value >> (i * 8);
+                    continue;
+                }
+                Flush(ipc, writes);
+                BySize(code.size, [&](auto type) {
+                    using Y = decltype(type);
+                    if (code.kind == Code::Modify)
+                        ipc.Modify<Y, true>(code.address,
+                                            (Shared::ModifyOp)code.op,
+                                            (Y)code.value);
+                    else if (code.kind == Code::If)
+                        ipc.BeginIf<Y>(code.address,
+                                       (Shared::Condition)code.op,
+                                       (Y)code.value);
+                });
+                if (code.kind == Code::End)
+                    ipc.EndIf();
+            }
+            Flush(ipc, writes);
+        } catch (...) {
+            // the batch has to be finalized no matter what
+            ipc.FinalizeBatch();
+            throw;
+        }
+        return ipc.FinalizeBatch();
+    }
+
+    /**
+     * Returns the number of patch lines that could not be compiled, and
+     * are ignored.
+     */
+    auto Unsupported() const -> unsigned int { return unsupported; }
+
+    /**
+     * Pnach Initializer, parsing a file.
+     * @param file The contents of the file.
+     */
+    Pnach(std::istream &file) {
+        // tests still open, as the number of lines left in each, and whether
+        // they are applied once
+        std::vector<std::pair<long, bool>> open;
+        std::vector<std::vector<std::string>> lines;
+
+        std::string line;
+        while (std::getline(file, line)) {
+            line = line.substr(0, line.find("//"));
+            std::erase_if(line, [](char c) { return isspace(c); });
+            if (line.rfind("patch=", 0) != 0)
+                continue;
+            std::vector<std::string> fields(1);
+            for (char c : line.substr(6)) {
+                if (c == ',')
+                    fields.emplace_back();
+                else
+                    fields.back() += c;
+            }
+            lines.push_back(std::move(fields));
+        }
+
+        // parsed ahead, for the codes spanning two lines
+        std::vector<std::pair<uint32_t, uint64_t>> values(lines.size());
+        std::vector<bool> valid(lines.size());
+        for (size_t i = 0; i < lines.size(); i++) {
+            if (lines[i].size() != 5)
+                continue;
+            try {
+                values[i] = { std::stoul(lines[i][2], nullptr, 16),
+                              std::stoull(lines[i][4], nullptr, 16) };
+                valid[i] = true;
+            } catch (const std::exception &) {
+            }
+        }
+
+        for (size_t i = 0; i < lines.size(); i++) {
+            size_t existing = open.size();
+            long guarded = -1;
+            bool once = valid[i] && lines[i][0] == "0";
+            bool two = false;
+            if (valid[i] && lines[i][1] == "EE") {
+                auto [address, value] = values[i];
+                const std::string &type = lines[i][3];
+                uint8_t size = type == "byte"     ? 1
+                               : type == "short"  ? 2
+                               : type == "word"   ? 4
+                               : type == "double" ? 8
+                                                  : 0;
+                if (size) {
+                    codes.push_back(
+                        Code{ Code::Write, once, address, size, 0, value });
+                    guarded = 0;
+                } else if (type == "extended") {
+                    std::pair<uint32_t, uint32_t> second;
+                    bool has_second = i + 1 < lines.size() && valid[i + 1];
+                    if (has_second)
+                        second = values[i + 1];
+                    guarded = Extended(address, value, once,
+                                       has_second ? &second : nullptr, two);
+                }
+            }
+            if (guarded < 0)
+                unsupported += 1;
+            if (guarded > 0)
+                open.push_back({ guarded, once });
+
+            // the second line of a code is guarded along with it
+            size_t lines_taken = two ? 2 : 1;
+            i += lines_taken - 1;
+
+            // tests close after the lines they guard, the inner ones first
+            size_t closed = open.size();
+            for (size_t t = 0; t < existing; t++) {
+                open[t].first -= std::min<long>(open[t].first, lines_taken);
+                if (open[t].first == 0 && closed == open.size())
+                    closed = t;
+            }
+            while (open.size() > closed) {
+                codes.push_back(
+                    Code{ Code::End, open.back().second, 0, 0, 0, 0 });
+                open.pop_back();
+            }
+        }
+        while (!open.empty()) {
+            codes.push_back(Code{ Code::End, open.back().second, 0, 0, 0, 0 });
+            open.pop_back();
+        }
+    }
+};
+
+/**
+ * Applies a pnach file continuously, from a thread of its own. @n
+ * The codes applied once are sent when it starts, the other ones then
+ * being sent once per frame: a single batch command each. Errors, eg if the
+ * emulator is not running, are ignored, the runner trying again on the next
+ * frame.
+ * @see Pnach
+ */
+class PnachRunner {
+  protected:
+    /**
+     * Batch command of the codes applied once.
+     */
+    Shared::BatchCommand once;
+
+    /**
+     * Batch command of the codes applied every frame.
+     */
+    Shared::BatchCommand every;
+
+    /**
+     * Number of times every was sent successfully.
+     */
+    std::atomic<uint64_t> applied = 0;
+
+    /**
+     * Thread applying the codes.
+     */
+    std::jthread thread;
+
+    /**
+     * Applies the codes until asked to stop.
+     * @param ipc The session to apply them with.
+     * @param stop Asks to stop.
+     * @param frame_end Whether every waits for the end of a frame.
+     */
+    auto Run(Shared &ipc, std::stop_token stop, bool frame_end) -> void {
+        bool booted = once.msg_size == 0;
+        while (!stop.stop_requested()) {
+            bool sent = false;
+            try {
+                // a paused emulator does not end frames: we do not want to
+                // wait for it forever
+                Shared::Deadline deadline(std::chrono::seconds(1));
+                if (!booted) {
+                    ipc.SendCommand(once);
+#ifdef C_FFI
+                    if (ipc.GetError() != Shared::Success)
+                        throw ipc.GetError();
+#endif
+                    booted = true;
+                }
+                if (every.msg_size > 0) {
+                    ipc.SendCommand(every);
+#ifdef C_FFI
+                    if (ipc.GetError() != Shared::Success)
+                        throw ipc.GetError();
+#endif
+                    applied += 1;
+                    sent = true;
+                }
+            } catch (Shared::IPCStatus) {
+            }
+            if (!frame_end || !sent)
+                std::this_thread::sleep_for(
+                    std::chrono::milliseconds(PNACH_PERIOD));
+        }
+    }
+
+  public:
+    /**
+     * Returns the number of times the continuous codes were applied so far.
+     */
+    auto Applied() const -> uint64_t { return applied; }
+
+    /**
+     * PnachRunner Initializer, starting to apply a file. @n
+     * On error throws an IPCStatus.
+     * @param ipc The session to apply it with, which has to outlive the
+     * runner. Best not shared with other threads, as it is used a lot.
+     * @param pnach The file to apply.
+     * @param frame_end Whether to apply the codes at the end of every frame,
+     * rather than about every PNACH_PERIOD.
+     * @see Shared::ExecuteOnFrameEnd
+     */
+    PnachRunner(Shared &ipc, Pnach &pnach, bool frame_end = false)
+        : once(pnach.Compile(ipc, true)),
+          every(pnach.Compile(ipc, false, frame_end)),
+          thread([this, &ipc, frame_end](std::stop_token stop) {
+              Run(ipc, stop, frame_end);
+          }) {}
+
+    PnachRunner(const PnachRunner &rhs) = delete;
+    PnachRunner &operator=(const PnachRunner &rhs) = delete;
+};
+
+}; // namespace PINE
@@ -0,0 +1,290 @@
+#pragma once
+
+#include "pine.h"
+#include <algorithm>
+#include <bit>
+#include <vector>
+
+/**
+ * Largest gap between two spans of candidates the Scanner reads with a single
+ * read rather than two.
+ * @see Scanner
+ */
+#define SCAN_GAP_SIZE 4096
+
+namespace PINE {
+
+/**
+ * Incremental memory scanner, the usual way to search for a variable of a
+ * game. @n
+ * A scan compares every candidate of a range of memory, either to a value
+ * ("equal to 100") or to what it was at the previous scan ("decreased"), and
+ * only keeps the ones matching. Candidates are every address aligned to the
+ * size of the searched type at first. @n
+ * Memory is fetched in large blocks with a single batch command, skipping the
+ * parts without candidates left, and compared in place 64 candidates at a
+ * time against a bitmap of them. A scan is not thread safe.
+ * @param T The type of the variable to search for (eg uint32_t, float).
+ * @see Shared
+ */
+template <typename T>
+class Scanner {
+  public:
+    /**
+     * Comparisons a scan keeps its candidates with. @n
+     * The relative ones compare memory to what it was at the previous scan or
+     * Reset.
+     */
+    enum Comparison : unsigned int {
+        Equal = 0,     /**< Equal to the value. */
+        NotEqual = 1,  /**< Not equal to the value. */
+        Greater = 2,   /**< Greater than the value. */
+        Less = 3,      /**< Less than the value. */
+        Changed = 4,   /**< Changed since the previous scan. */
+        Unchanged = 5, /**< Unchanged since the previous scan. */
+        Increased = 6, /**< Increased since the previous scan. */
+        Decreased = 7  /**< Decreased since the previous scan. */
+    };
+
+  protected:
+    /**
+     * Session to scan the memory of.
+     */
+    Shared &ipc;
+
+    /**
+     * Start of the scanned range.
+     */
+    uint32_t start;
+
+    /**
+     * Number of variables in the scanned range.
+     */
+    size_t slots;
+
+    /**
+     * Candidates left, one bit per variable.
+     */
+    std::vector<uint64_t> bits;
+
+    /**
+     * Number of candidates left.
+     */
+    size_t candidates = 0;
+
+    /**
+     * Memory as of the last and previous scan, padded to whole words of
+     * bits. Only spans holding candidates are kept up to date.
+     */
+    std::vector<T> current, previous;
+
+    /**
+     * Whether memory was fetched at least once.
+     */
+    bool fetched = false;
+
+    /**
+     * Most a read of the fetching batch command reads, as each has to fit
+     * in a reply of its own.
+     */
+    static constexpr uint32_t chunk = (MAX_IPC_RETURN_SIZE - 4 - 1) /
+                                      SCAN_GAP_SIZE * SCAN_GAP_SIZE;
+
+    /**
+     * Makes every variable of the range a candidate.
+     */
+    auto Fill() -> void {
+        std::fill(bits.begin(), bits.end(), UINT64_MAX);
+        if (slots % 64)
+            bits.back() = (1ull << (slots % 64)) - 1;
+        candidates = slots;
+    }
+
+    /**
+     * Fetches every span of memory holding candidates, with a single batch
+     * command, into current. The previous current becomes previous. @n
+     * On error throws an IPCStatus, leaving the snapshots untouched.
+     * @return false on error under C_FFI.
+     */
+    auto Fetch() -> bool {
+        const size_t span = 64 * sizeof(T);
+        const size_t size = slots * sizeof(T);
+
+        // coalesce words of candidates into reads, merging the ones close
+        // enough to each other to not be worth a read of their own
+        std::vector<std::pair<size_t, size_t>> reads;
+        for (size_t w = 0; w < bits.size(); w++) {
+            if (!bits[w])
+                continue;
+            size_t from = w * span, to = std::min(from + span, size);
+            if (!reads.empty() && from - reads.back().second < SCAN_GAP_SIZE)
+                reads.back().second = to;
+            else
+                reads.push_back({ from, to });
+        }
+        if (reads.empty()) {
+            std::swap(current, previous);
+            return true;
+        }
+
+        ipc.InitializeBatch();
+        for (auto [from, to] : reads)
+            for (size_t at = from; at < to; at += chunk)
+                ipc.ReadRange<true>(start + at,
+                                    std::min<size_t>(chunk, to - at));
+        auto batch = ipc.FinalizeBatch();
+        ipc.SendCommand(batch);
+#ifdef C_FFI
+        if (ipc.GetError() != Shared::Success)
+            return false;
+#endif
+        std::swap(current, previous);
+        char *dst = (char *)current.data();
+        unsigned int reply = 0;
+        for (auto [from, to] : reads) {
+            for (size_t at = from; at < to; at += chunk) {
+                memcpy(&dst[at],
+                       ipc.GetReply<Shared::MsgReadRange>(batch, reply++),
+                       std::min<size_t>(chunk, to - at));
+            }
+        }
+        fetched = true;
+        return true;
+    }
+
+    /**
+     * Keeps the candidates matching a comparison. @n
+     * Written for the compiler to vectorize: every word of candidates left
+     * is compared as a whole into a byte per variable, without branches.
+     * @param match The comparison, of the current and previous values.
+     * @return The number of candidates left.
+     */
+    template <typename F>
+    auto Narrow(F match) -> size_t {
+        size_t count = 0;
+        const T *now = current.data(), *then = previous.data();
+        for (size_t w = 0; w < bits.size(); w++) {
+            if (!bits[w])
+                continue;
+            uint8_t matches[64];
+            for (unsigned int i = 0; i < 64; i++)
+                matches[i] = match(now[w * 64 + i], then[w * 64 + i]);
+
+            // gathers the low bit of 8 bytes at once into the top byte,
+            // first byte in the lowest bit on our little endian hosts
+            uint64_t hits = 0;
+            for (unsigned int i = 0; i < 64; i += 8) {
+                uint64_t bytes;
+                memcpy(&bytes, &matches[i], sizeof(bytes));
+                hits |= (bytes * 0x0102040810204080ull >> 56) << i;
+            }
+            bits[w] &= hits;
+            count += std::popcount(bits[w]);
+        }
+        candidates = count;
+        return count;
+    }
+
+  public:
+    /**
+     * Makes every address a candidate again, and takes a snapshot of memory
+     * for the next relative scan to compare to, eg to search for a variable
+     * of unknown value. @n
+     * On error throws an IPCStatus.
+     * @return The number of candidates.
+     */
+    auto Reset() -> size_t {
+        Fill();
+        Fetch();
+        return candidates;
+    }
+
+    /**
+     * Scans memory, only keeping the candidates matching a comparison. @n
+     * On error throws an IPCStatus, candidates being left as they were.
+     * @param comparison What to compare memory to.
+     * @param value The value to compare to, for the comparisons needing
+     * one.
+     * @return The number of candidates left.
+     * @see Comparison
+     */
+    auto Scan(Comparison comparison, T value = T()) -> size_t {
+        if (!fetched && comparison >= Changed && !Fetch())
+            return candidates;
+        if (!Fetch())
+            return candidates;
+        switch (comparison) {
+            case Equal:
+                return Narrow([=](T a, T) { return a == value; });
+            case NotEqual:
+                return Narrow([=](T a, T) { return a != value; });
+            case Greater:
+                return Narrow([=](T a, T) { return a > value; });
+            case Less:
+                return Narrow([=](T a, T) { return a < value; });
+            case Changed:
+                return Narrow([](T a, T b) { return a != b; });
+            case Unchanged:
+                return Narrow([](T a, T b) { return a == b; });
+            case Increased:
+                return Narrow([](T a, T b) { return a > b; });
+            case Decreased:
+                return Narrow([](T a, T b) { return a < b; });
+        }
+        return candidates;
+    }
+
+    /**
+     * Returns the number of candidates left.
+     */
+    auto Count() const -> size_t { return candidates; }
+
+    /**
+     * Returns the addresses of the candidates left, in order.
+     * @param max The most addresses to return.
+     */
+    auto Candidates(size_t max = SIZE_MAX) const -> std::vector<uint32_t> {
+        std::vector<uint32_t> addresses;
+        addresses.reserve(std::min(max, candidates));
+        for (size_t w = 0; w < bits.size(); w++) {
+            for (uint64_t word = bits[w]; word; word &= word - 1) {
+                if (addresses.size() == max)
+                    return addresses;
+                size_t slot = w * 64 + std::countr_zero(word);
+                addresses.push_back(start + slot * sizeof(T));
+            }
+        }
+        return addresses;
+    }
+
+    /**
+     * Returns the value of a candidate as of the last scan.
+     * @param address The address of the candidate.
+     */
+    auto Value(uint32_t address) const -> T {
+        return current[(address - start) / sizeof(T)];
+    }
+
+    /**
+     * Scanner Initializer. @n
+     * Every address of the range aligned to the size of the variable
+     * searched is a candidate.
+     * @param ipc The session to scan the memory of, which has to outlive the
+     * scanner.
+     * @param start The start of the range to scan, 32MiB of EE RAM by
+     * default.
+     * @param length The length of the range to scan.
+     */
+    Scanner(Shared &ipc, uint32_t start = 0,
+            uint32_t length = 32 * 1024 * 1024)
+        : ipc(ipc), start(start), slots(length / sizeof(T)),
+          bits((slots + 63) / 64),
+          current(bits.size() * 64), previous(bits.size() * 64) {
+        Fill();
+    }
+
+    Scanner(const Scanner &rhs) = delete;
+    Scanner &operator=(const Scanner &rhs) = delete;
+};
+
+}; // namespace PINE
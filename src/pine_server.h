@@ -0,0 +1,1162 @@
+#pragma once
+
+#include "pine.h"
+#include <list>
+#include <map>
+
+/**
+ * The PINE reference server. @n
+ * This is a server side implementation of the PINE protocol, as described in
+ * standard/draft.dtd, backed by a flat memory image standing in for the
+ * memory of an emulated game. @n
+ * It is meant to run client tests and benchmarks without an emulator, and as
+ * a starting point for emulator authors: override the memory and savestate
+ * hooks to plug it into a real emulator. @n
+ * Every connection is served by its own thread, messages being processed one
+ * at a time across all of them.
+ */
+namespace PINE {
+
+class Server {
+  public:
+    /**
+     * Emulator version string, returned by MsgVersion.
+     */
+    std::string version;
+
+    /**
+     * Game title, returned by MsgTitle.
+     */
+    std::string title = "PINE reference game";
+
+    /**
+     * Game ID, returned by MsgID.
+     */
+    std::string id = "PINE-00000";
+
+    /**
+     * Game UUID, returned by MsgUUID.
+     */
+    std::string uuid = "00000000";
+
+    /**
+     * Game version, returned by MsgGameVersion.
+     */
+    std::string game_version = "1.00";
+
+    /**
+     * Emulator status, returned by MsgStatus.
+     */
+    std::atomic<Shared::EmuStatus> status{ Shared::Running };
+
+  protected:
+    /**
+     * IPC Slot identifier. @n
+     * On Windows, the TCP port to listen to.
+     */
+    uint16_t slot;
+
+#if !defined(_WIN32) || defined(DOXYGEN)
+    /**
+     * Unix socket name. @n
+     * Same as the one Shared computes for the same slot.
+     * @see Shared::SocketPath
+     */
+    std::string SOCKET_NAME;
+#endif
+
+#if defined(_WIN32) || defined(DOXYGEN)
+    /**
+     * Listening socket. @n
+     * On windows it uses the type SOCKET, on linux int.
+     */
+    SOCKET sock = INVALID_SOCKET;
+#else
+    int sock = -1;
+#endif
+
+    /**
+     * Emulated memory. @n
+     * Used by the default memory hooks, addresses are offsets in it.
+     * @see ReadMemory
+     * @see WriteMemory
+     */
+    std::vector<char> memory;
+
+    /**
+     * Savestates of the emulated memory, per slot.
+     * @see SaveState
+     * @see LoadState
+     */
+    std::unordered_map<uint8_t, std::vector<char>> savestates;
+
+    /**
+     * Serializes message processing across connections, as an emulator
+     * would.
+     */
+    std::mutex memory_blocking;
+
+    /**
+     * Whether the server is accepting and serving connections.
+     */
+    std::atomic<bool> running{ false };
+
+    /**
+     * Number of frames ended so far. @n
+     * Protected by memory_blocking.
+     * @see Frame
+     */
+    uint32_t frame = 0;
+
+    /**
+     * Number of messages waiting for the end of the current frame. @n
+     * Protected by memory_blocking.
+     * @see Shared::MsgFrameEnd
+     */
+    unsigned int waiting = 0;
+
+    /**
+     * Number of messages Frame woke up that are still running. @n
+     * Protected by memory_blocking.
+     * @see Shared::MsgFrameEnd
+     */
+    unsigned int woken = 0;
+
+    /**
+     * Signaled by Frame once it ended a frame, along with memory_blocking.
+     */
+    std::condition_variable frame_ended;
+
+    /**
+     * Signaled whenever a message Frame woke up is done running.
+     */
+    std::condition_variable frame_resumed;
+
+    /**
+     * Thread accepting new connections.
+     */
+    std::thread acceptor;
+
+    /**
+     * A client connection and the thread serving it.
+     */
+    struct Client {
+#if defined(_WIN32) || defined(DOXYGEN)
+        SOCKET sock; /**< Client socket. */
+#else
+        int sock;
+#endif
+        std::thread thread;              /**< Thread serving it. */
+        std::atomic<bool> done{ false }; /**< Whether it is done. */
+    };
+
+    /**
+     * Clients currently connected.
+     */
+    std::list<Client> clients;
+
+    /**
+     * Protects clients.
+     */
+    std::mutex clients_blocking;
+
+    /**
+     * Memory block watched by a subscriber.
+     * @see Frame
+     */
+    struct Watch {
+        uint32_t subscriber;    /**< Subscriber to push events to. */
+        uint32_t address;       /**< Address of the block. */
+        std::vector<char> last; /**< Contents of the block last frame. */
+    };
+
+    /**
+     * Watched memory blocks, by watch identifier. @n
+     * Protected by memory_blocking, as everything touching the memory.
+     */
+    std::map<uint32_t, Watch> watches;
+
+    /**
+     * Next watch identifier to hand out.
+     */
+    uint32_t next_watch = 1;
+
+    /**
+     * Clients that switched to an event connection, by subscriber
+     * identifier. @n
+     * Protected by memory_blocking.
+     */
+    std::unordered_map<uint32_t, Client *> subscribers;
+
+    /**
+     * Next subscriber identifier to hand out.
+     */
+    uint32_t next_subscriber = 1;
+
+    /**
+     * Reads emulated memory. @n
+     * Override this to serve the memory of an actual emulator.
+     * @param address The address to start reading at.
+     * @param dst Where to copy the memory to.
+     * @param length The number of bytes to read.
+     * @return false if the memory cannot be read, failing the message.
+     */
+    virtual auto ReadMemory(uint32_t address, char *dst, uint32_t length)
+        -> bool {
+        if ((uint64_t)address + length > memory.size())
+            return false;
+        memcpy(dst, &memory[address], length);
+        return true;
+    }
+
+    /**
+     * Writes emulated memory. @n
+     * Override this to serve the memory of an actual emulator.
+     * @param address The address to start writing at.
+     * @param src The bytes to write.
+     * @param length The number of bytes to write.
+     * @return false if the memory cannot be written, failing the message.
+     */
+    virtual auto WriteMemory(uint32_t address, const char *src,
+                             uint32_t length) -> bool {
+        if ((uint64_t)address + length > memory.size())
+            return false;
+        memcpy(&memory[address], src, length);
+        return true;
+    }
+
+    /**
+     * Saves a savestate of the emulated memory.
+     * @param slot The savestate slot to use.
+     * @return false on failure, failing the message.
+     */
+    virtual auto SaveState(uint8_t slot) -> bool {
+        savestates[slot] = memory;
+        return true;
+    }
+
+    /**
+     * Loads a savestate of the emulated memory.
+     * @param slot The savestate slot to use.
+     * @return false if there is no savestate in this slot, failing the
+     * message.
+     */
+    virtual auto LoadState(uint8_t slot) -> bool {
+        auto state = savestates.find(slot);
+        if (state == savestates.end())
+            return false;
+        memory = state->second;
+        return true;
+    }
+
+    /**
+     * Appends a string reply to an answer.
+     * @param reply The answer.
+     * @param str The string to append.
+     */
+    static auto PutString(std::vector<char> &reply, const std::string &str)
+        -> void {
+        // sent along with its NUL terminator
+        uint32_t size = str.size() + 1;
+        size_t at = reply.size();
+        reply.resize(at + 4 + size);
+        Shared::ToArray<uint32_t>(reply.data(), size, at);
+        memcpy(&reply[at + 4], str.c_str(), size);
+    }
+
+    /**
+     * Skips a command of a request message, as asked by a MsgIf whose
+     * condition does not hold. @n
+     * Its reply is still sent, zeroed, for the ones of the commands
+     * following it to be where the client expects them; a string one being
+     * empty.
+     * @param op The opcode of the command.
+     * @param msg The message.
+     * @param length The length of the message.
+     * @param i Where the arguments of the command start, moved past them.
+     * @param reply Where to append the reply of the command.
+     * @return false if the command is malformed.
+     */
+    static auto Skip(Shared::IPCCommand op, char *msg, uint32_t length,
+                     uint32_t &i, std::vector<char> &reply) -> bool {
+        uint32_t size = 0, answer = 0;
+        // some commands only know their size from their first arguments
+        auto has = [&](uint32_t size) { return length - i >= size; };
+        switch (op) {
+            case Shared::MsgRead8:
+            case Shared::MsgRead16:
+            case Shared::MsgRead32:
+            case Shared::MsgRead64:
+                size = 4;
+                answer = 1 << (op - Shared::MsgRead8);
+                break;
+            case Shared::MsgWrite8:
+            case Shared::MsgWrite16:
+            case Shared::MsgWrite32:
+            case Shared::MsgWrite64:
+                size = 4 + (1 << (op - Shared::MsgWrite8));
+                break;
+            case Shared::MsgModify8:
+            case Shared::MsgModify16:
+            case Shared::MsgModify32:
+            case Shared::MsgModify64:
+                answer = 1 << (op - Shared::MsgModify8);
+                size = 5 + answer;
+                break;
+            case Shared::MsgSaveState:
+            case Shared::MsgLoadState:
+                size = 1;
+                break;
+            case Shared::MsgVersion:
+            case Shared::MsgTitle:
+            case Shared::MsgID:
+            case Shared::MsgUUID:
+            case Shared::MsgGameVersion:
+            case Shared::MsgStatus:
+            case Shared::MsgFrameEnd:
+                answer = 4;
+                break;
+            case Shared::MsgReadRange:
+                if (!has(8))
+                    return false;
+                size = 8;
+                answer = Shared::FromArray<uint32_t>(msg, i + 4);
+                if (answer > MAX_IPC_SIZE)
+                    return false;
+                break;
+            case Shared::MsgWriteRange:
+                if (!has(8))
+                    return false;
+                size = 8 + Shared::FromArray<uint32_t>(msg, i + 4);
+                break;
+            case Shared::MsgWatch:
+                size = 12;
+                answer = 4;
+                break;
+            case Shared::MsgUnwatch:
+                size = 4;
+                break;
+            case Shared::MsgReadPointerChain:
+                if (!has(6))
+                    return false;
+                size = 6 + 4 * (unsigned char)msg[i + 5];
+                answer = (unsigned char)msg[i + 4];
+                break;
+            case Shared::MsgIf:
+                if (!has(6))
+                    return false;
+                size = 6 + (unsigned char)msg[i + 4] + 4;
+                answer = 1;
+                break;
+            default:
+                return false;
+        }
+        if (!has(size))
+            return false;
+        i += size;
+        reply.resize(reply.size() + answer);
+        return true;
+    }
+
+    /**
+     * Executes a request message. @n
+     * Batch messages are executed command after command, the whole message
+     * failing if any of them does. @n
+     * Commands following a MsgFrameEnd are executed at the end of the next
+     * frame, while Frame waits for them. Commands a MsgIf skips are not
+     * executed at all.
+     * @param msg The message, without its size header.
+     * @param length The length of the message.
+     * @param reply Where to build the answer, size header included.
+     */
+    auto Process(char *msg, uint32_t length, std::vector<char> &reply)
+        -> void {
+        std::unique_lock<std::mutex> lock(memory_blocking);
+        reply.assign(5, 0);
+        bool ok = true;
+        // whether Frame woke us up and is waiting for us to be done
+        bool resumed = false;
+        auto resume = [&]() {
+            if (resumed) {
+                resumed = false;
+                woken -= 1;
+                frame_resumed.notify_all();
+            }
+        };
+        uint32_t i = 0;
+        // number of commands left to skip
+        uint32_t skip = 0;
+        // checks that the arguments of a command are all there
+        auto args = [&](uint32_t size) {
+            ok = length - i >= size;
+            return ok;
+        };
+        while (ok && i < length) {
+            auto op = (Shared::IPCCommand)(unsigned char)msg[i++];
+            if (skip > 0) {
+                skip -= 1;
+                ok = Skip(op, msg, length, i, reply);
+                continue;
+            }
+            switch (op) {
+                case Shared::MsgRead8:
+                case Shared::MsgRead16:
+                case Shared::MsgRead32:
+                case Shared::MsgRead64: {
+                    if (!args(4))
+                        break;
+                    uint32_t size = 1 << (op - Shared::MsgRead8);
+                    size_t at = reply.size();
+                    reply.resize(at + size);
+                    ok = ReadMemory(Shared::FromArray<uint32_t>(msg, i),
+                                    &reply[at], size);
+                    i += 4;
+                    break;
+                }
+                case Shared::MsgWrite8:
+                case Shared::MsgWrite16:
+                case Shared::MsgWrite32:
+                case Shared::MsgWrite64: {
+                    uint32_t size = 1 << (op - Shared::MsgWrite8);
+                    if (!args(4 + size))
+                        break;
+                    ok = WriteMemory(Shared::FromArray<uint32_t>(msg, i),
+                                     &msg[i + 4], size);
+                    i += 4 + size;
+                    break;
+                }
+                case Shared::MsgModify8:
+                case Shared::MsgModify16:
+                case Shared::MsgModify32:
+                case Shared::MsgModify64: {
+                    uint32_t size = 1 << (op - Shared::MsgModify8);
+                    if (!args(5 + size))
+                        break;
+                    uint32_t address = Shared::FromArray<uint32_t>(msg, i);
+                    // little endian, the low bytes are the ones of the value
+                    uint64_t value = 0, operand = 0;
+                    memcpy(&operand, &msg[i + 5], size);
+                    size_t at = reply.size();
+                    reply.resize(at + size);
+                    ok = ReadMemory(address, &reply[at], size);
+                    memcpy(&value, &reply[at], size);
+                    switch ((unsigned char)msg[i + 4]) {
+                        case Shared::Add:
+                            value += operand;
+                            break;
+                        case Shared::Sub:
+                            value -= operand;
+                            break;
+                        case Shared::And:
+                            value &= operand;
+                            break;
+                        case Shared::Or:
+                            value |= operand;
+                            break;
+                        case Shared::Xor:
+                            value ^= operand;
+                            break;
+                        case Shared::Clear:
+                            value &= ~operand;
+                            break;
+                        default:
+                            ok = false;
+                            break;
+                    }
+                    if (ok)
+                        ok = WriteMemory(address, (char *)&value, size);
+                    i += 5 + size;
+                    break;
+                }
+                case Shared::MsgSaveState:
+                case Shared::MsgLoadState:
+                    if (!args(1))
+                        break;
+                    ok = (op == Shared::MsgSaveState) ? SaveState(msg[i])
+                                                       : LoadState(msg[i]);
+                    i += 1;
+                    break;
+                case Shared::MsgVersion:
+                    PutString(reply, version);
+                    break;
+                case Shared::MsgTitle:
+                    PutString(reply, title);
+                    break;
+                case Shared::MsgID:
+                    PutString(reply, id);
+                    break;
+                case Shared::MsgUUID:
+                    PutString(reply, uuid);
+                    break;
+                case Shared::MsgGameVersion:
+                    PutString(reply, game_version);
+                    break;
+                case Shared::MsgStatus: {
+                    size_t at = reply.size();
+                    reply.resize(at + 4);
+                    Shared::ToArray<uint32_t>(reply.data(), status, at);
+                    break;
+                }
+                case Shared::MsgReadRange: {
+                    if (!args(8))
+                        break;
+                    uint32_t size = Shared::FromArray<uint32_t>(msg, i + 4);
+                    if (size > MAX_IPC_SIZE) {
+                        ok = false;
+                        break;
+                    }
+                    size_t at = reply.size();
+                    reply.resize(at + size);
+                    ok = ReadMemory(Shared::FromArray<uint32_t>(msg, i),
+                                    &reply[at], size);
+                    i += 8;
+                    break;
+                }
+                case Shared::MsgReadPointerChain: {
+                    if (!args(6))
+                        break;
+                    uint32_t address = Shared::FromArray<uint32_t>(msg, i);
+                    uint32_t size = (unsigned char)msg[i + 4];
+                    uint32_t count = (unsigned char)msg[i + 5];
+                    i += 6;
+                    if (!args(4 * count))
+                        break;
+                    if (size != 1 && size != 2 && size != 4 && size != 8) {
+                        ok = false;
+                        break;
+                    }
+                    for (uint32_t n = 0; ok && n < count; n++, i += 4) {
+                        char pointer[4];
+                        ok = ReadMemory(address, pointer, 4);
+                        address = Shared::FromArray<uint32_t>(pointer, 0) +
+                                  Shared::FromArray<uint32_t>(msg, i);
+                    }
+                    if (!ok)
+                        break;
+                    size_t at = reply.size();
+                    reply.resize(at + size);
+                    ok = ReadMemory(address, &reply[at], size);
+                    break;
+                }
+                case Shared::MsgIf: {
+                    if (!args(6))
+                        break;
+                    uint32_t address = Shared::FromArray<uint32_t>(msg, i);
+                    uint32_t size = (unsigned char)msg[i + 4];
+                    unsigned char condition = msg[i + 5];
+                    i += 6;
+                    if (!args(size + 4))
+                        break;
+                    if (size != 1 && size != 2 && size != 4 && size != 8) {
+                        ok = false;
+                        break;
+                    }
+                    // little endian, the low bytes are the ones of the value
+                    uint64_t value = 0, operand = 0;
+                    memcpy(&operand, &msg[i], size);
+                    ok = ReadMemory(address, (char *)&value, size);
+                    bool holds = false;
+                    switch (condition) {
+                        case Shared::Equal:
+                            holds = value == operand;
+                            break;
+                        case Shared::NotEqual:
+                            holds = value != operand;
+                            break;
+                        case Shared::Less:
+                            holds = value < operand;
+                            break;
+                        case Shared::Greater:
+                            holds = value > operand;
+                            break;
+                        case Shared::LessEqual:
+                            holds = value <= operand;
+                            break;
+                        case Shared::GreaterEqual:
+                            holds = value >= operand;
+                            break;
+                        default:
+                            ok = false;
+                            break;
+                    }
+                    if (!holds)
+                        skip = Shared::FromArray<uint32_t>(msg, i + size);
+                    reply.push_back(holds);
+                    i += size + 4;
+                    break;
+                }
+                case Shared::MsgWriteRange: {
+                    if (!args(8))
+                        break;
+                    uint32_t size = Shared::FromArray<uint32_t>(msg, i + 4);
+                    if (!args(8 + size))
+                        break;
+                    ok = WriteMemory(Shared::FromArray<uint32_t>(msg, i),
+                                     &msg[i + 8], size);
+                    i += 8 + size;
+                    break;
+                }
+                case Shared::MsgWatch: {
+                    if (!args(12))
+                        break;
+                    uint32_t subscriber = Shared::FromArray<uint32_t>(msg, i);
+                    uint32_t address = Shared::FromArray<uint32_t>(msg, i + 4);
+                    uint32_t size = Shared::FromArray<uint32_t>(msg, i + 8);
+                    i += 12;
+                    // an event has to fit in a reply
+                    ok = subscribers.count(subscriber) > 0 && size > 0 &&
+                         size <= MAX_IPC_RETURN_SIZE - 13;
+                    if (!ok)
+                        break;
+                    Watch watch{ subscriber, address,
+                                 std::vector<char>(size) };
+                    ok = ReadMemory(address, watch.last.data(), size);
+                    if (!ok)
+                        break;
+                    size_t at = reply.size();
+                    reply.resize(at + 4);
+                    Shared::ToArray<uint32_t>(reply.data(), next_watch, at);
+                    watches.emplace(next_watch++, std::move(watch));
+                    break;
+                }
+                case Shared::MsgUnwatch:
+                    if (!args(4))
+                        break;
+                    ok = watches.erase(Shared::FromArray<uint32_t>(msg, i)) > 0;
+                    i += 4;
+                    break;
+                case Shared::MsgFrameEnd: {
+                    // a second one waits for the frame after, letting the
+                    // emulator go on in the meantime
+                    resume();
+                    uint32_t seen = frame;
+                    waiting += 1;
+                    frame_ended.wait(
+                        lock, [&]() { return frame != seen || !running; });
+                    if (frame == seen) {
+                        waiting -= 1;
+                        ok = false;
+                        break;
+                    }
+                    resumed = true;
+                    size_t at = reply.size();
+                    reply.resize(at + 4);
+                    Shared::ToArray<uint32_t>(reply.data(), frame, at);
+                    break;
+                }
+                // MsgSharedMemory and MsgSubscribe are only valid on their
+                // own, and are handled by Serve.
+                default:
+                    ok = false;
+                    break;
+            }
+        }
+        resume();
+        if (!ok || reply.size() > MAX_IPC_SIZE)
+            reply.resize(5);
+        Shared::ToArray<uint32_t>(reply.data(), reply.size(), 0);
+        reply[4] = ok ? Shared::IPC_OK : Shared::IPC_FAIL;
+    }
+
+    /**
+     * Executes all the complete messages at the beginning of a buffer.
+     * @param buffer The bytes received so far. Executed messages are
+     * removed from it.
+     * @param answer Called with the answer of every message, returns false
+     * if it could not be sent.
+     * @return false if the client has to be dropped.
+     */
+    template <typename F>
+    auto Dispatch(std::vector<char> &buffer, F &&answer) -> bool {
+        std::vector<char> reply;
+        size_t start = 0;
+        bool alive = true;
+        while (alive && buffer.size() - start >= 4) {
+            uint32_t size = Shared::FromArray<uint32_t>(buffer.data(), start);
+            // we cannot know where the next message starts anymore
+            if (size < 4 || size > MAX_IPC_SIZE) {
+                alive = false;
+                break;
+            }
+            if (buffer.size() - start < size)
+                break;
+            Process(&buffer[start + 4], size - 4, reply);
+            alive = answer(reply);
+            start += size;
+        }
+        buffer.erase(buffer.begin(), buffer.begin() + start);
+        return alive;
+    }
+
+#if defined(__linux__) || defined(DOXYGEN)
+    /**
+     * Serves a client through shared memory, until it disconnects.
+     * @param client The client, whose socket is only used to notice it
+     * going away.
+     * @param shm The shared memory region it handed over.
+     * @see Shared::ShmRegion
+     */
+    auto ServeSharedMemory(Client &client, Shared::ShmRegion *shm) -> void {
+        std::vector<char> buffer;
+        std::vector<char> chunk(65536);
+        Shared::ShmRing &requests = shm->request;
+        Shared::ShmRing &replies = shm->reply;
+
+        auto alive = [&]() {
+            char byte;
+            auto peek = recv(client.sock, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+            return running &&
+                   (peek > 0 || (peek < 0 && would_block_portable()));
+        };
+        auto answer = [&](const std::vector<char> &reply) {
+            uint32_t sent = 0;
+            while (sent < reply.size()) {
+                uint32_t tail = replies.tail.load();
+                uint32_t pushed =
+                    replies.Push(&reply[sent], reply.size() - sent);
+                sent += pushed;
+                if (pushed == 0 &&
+                    !replies.Wait(replies.tail, tail, SHM_TIMEOUT) && !alive())
+                    return false;
+            }
+            return true;
+        };
+
+        while (true) {
+            uint32_t got = requests.Pop(chunk.data(), chunk.size());
+            if (got == 0) {
+                if (!requests.Wait(requests.head, requests.tail.load(),
+                                   SHM_TIMEOUT) &&
+                    !alive())
+                    return;
+                continue;
+            }
+            buffer.insert(buffer.end(), chunk.begin(), chunk.begin() + got);
+            if (!Dispatch(buffer, answer))
+                return;
+        }
+    }
+
+    /**
+     * Switches a client to shared memory, if the region it handed over is
+     * valid.
+     * @param client The client.
+     * @param fd The file descriptor of the shared memory region.
+     * @return false if the region is invalid, in which case the client stays
+     * on the socket.
+     */
+    auto InitSharedMemory(Client &client, int fd) -> bool {
+        void *region = mmap(nullptr, sizeof(Shared::ShmRegion),
+                            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (region == MAP_FAILED)
+            return false;
+        Shared::ShmRegion *shm = (Shared::ShmRegion *)region;
+        if (shm->magic != SHM_MAGIC) {
+            munmap(region, sizeof(Shared::ShmRegion));
+            return false;
+        }
+        char ok[5];
+        Shared::ToArray<uint32_t>(ok, 5, 0);
+        ok[4] = Shared::IPC_OK;
+        if (write_portable(client.sock, ok, 5) == 5)
+            ServeSharedMemory(client, shm);
+        munmap(region, sizeof(Shared::ShmRegion));
+        return true;
+    }
+#endif
+
+    /**
+     * Serves a client that switched to an event connection, until it
+     * disconnects. @n
+     * Events are pushed by Frame, the client is not expected to send
+     * anything anymore.
+     * @param client The client.
+     */
+    auto ServeEvents(Client &client) -> void {
+        uint32_t subscriber;
+        {
+            std::lock_guard<std::mutex> lock(memory_blocking);
+            subscriber = next_subscriber++;
+            subscribers[subscriber] = &client;
+            // answered under the lock, so that it comes before any event
+            char ok[9];
+            Shared::ToArray<uint32_t>(ok, 9, 0);
+            ok[4] = Shared::IPC_OK;
+            Shared::ToArray<uint32_t>(ok, subscriber, 5);
+            write_portable(client.sock, ok, 9);
+        }
+
+        char byte;
+        while (running && read_portable(client.sock, &byte, 1) > 0) {
+        }
+
+        std::lock_guard<std::mutex> lock(memory_blocking);
+        subscribers.erase(subscriber);
+        std::erase_if(watches, [subscriber](const auto &watch) {
+            return watch.second.subscriber == subscriber;
+        });
+    }
+
+    /**
+     * Pushes an event to a subscriber, without blocking. @n
+     * A subscriber too slow to keep up is disconnected rather than stalling
+     * the emulator.
+     * @param client The subscriber.
+     * @param event The event, size header included.
+     */
+    auto PushEvent(Client &client, const std::vector<char> &event) -> void {
+        auto sent =
+            write_nonblock_portable(client.sock, event.data(), event.size());
+        if (sent != (decltype(sent))event.size()) {
+#ifdef _WIN32
+            shutdown(client.sock, SD_BOTH);
+#else
+            shutdown(client.sock, SHUT_RDWR);
+#endif
+        }
+    }
+
+    /**
+     * Serves a client through its socket, until it disconnects.
+     * @param client The client.
+     */
+    auto Serve(Client &client) -> void {
+        std::vector<char> buffer;
+        std::vector<char> chunk(65536);
+        auto answer = [&](const std::vector<char> &reply) {
+            size_t sent = 0;
+            while (sent < reply.size()) {
+                auto tmp_length = write_portable(
+                    client.sock, &reply[sent], reply.size() - sent);
+                if (tmp_length <= 0)
+                    return false;
+                sent += tmp_length;
+            }
+            return true;
+        };
+
+        while (running) {
+#ifdef __linux__
+            // the shared memory region comes as ancillary data
+            int fd = -1;
+            struct iovec iov = { chunk.data(), chunk.size() };
+            char control[CMSG_SPACE(sizeof(int))];
+            struct msghdr hdr = {};
+            hdr.msg_iov = &iov;
+            hdr.msg_iovlen = 1;
+            hdr.msg_control = control;
+            hdr.msg_controllen = sizeof(control);
+            auto got = recvmsg(client.sock, &hdr, MSG_CMSG_CLOEXEC);
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+            if (got > 0 && cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+                cmsg->cmsg_type == SCM_RIGHTS)
+                memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+#else
+            auto got = read_portable(client.sock, chunk.data(), chunk.size());
+#endif
+            if (got <= 0)
+                break;
+            buffer.insert(buffer.end(), chunk.begin(), chunk.begin() + got);
+
+#ifdef __linux__
+            // the switch to shared memory is the only message in flight
+            if (buffer.size() == 5 && buffer[4] == Shared::MsgSharedMemory &&
+                Shared::FromArray<uint32_t>(buffer.data(), 0) == 5) {
+                buffer.clear();
+                if (fd >= 0 && InitSharedMemory(client, fd))
+                    break;
+                buffer = { 5, 0, 0, 0, (char)Shared::IPC_FAIL };
+                if (!answer(buffer))
+                    break;
+                buffer.clear();
+                continue;
+            }
+            if (fd >= 0)
+                close(fd);
+#endif
+            // the switch to an event connection is too
+            if (buffer.size() == 5 && buffer[4] == Shared::MsgSubscribe &&
+                Shared::FromArray<uint32_t>(buffer.data(), 0) == 5) {
+                ServeEvents(client);
+                break;
+            }
+            if (!Dispatch(buffer, answer))
+                break;
+        }
+        client.done = true;
+    }
+
+    /**
+     * Accepts new clients until the server is stopped.
+     */
+    auto Accept() -> void {
+        while (running) {
+            struct pollfd fd = { sock, POLLIN, 0 };
+            if (poll_portable(&fd, 1, 50) <= 0)
+                continue;
+            auto client_sock = accept(sock, nullptr, nullptr);
+#ifdef _WIN32
+            if (client_sock == INVALID_SOCKET)
+                continue;
+#else
+            if (client_sock < 0)
+                continue;
+#endif
+            std::lock_guard<std::mutex> lock(clients_blocking);
+            // we take the occasion to clean up after clients that left
+            for (auto it = clients.begin(); it != clients.end();) {
+                if (it->done) {
+                    it->thread.join();
+                    close_portable(it->sock);
+                    it = clients.erase(it);
+                } else
+                    it++;
+            }
+            Client &client = clients.emplace_back();
+            client.sock = client_sock;
+            client.thread = std::thread([this, &client]() { Serve(client); });
+        }
+    }
+
+  public:
+    /**
+     * Signals the end of an emulated frame. @n
+     * Emulators call this at vblank, with the game paused: messages waiting
+     * on a MsgFrameEnd are run first, then every watched memory block is
+     * compared to what it was at the previous frame, and its new contents
+     * pushed to its subscriber if it changed.
+     */
+    auto Frame() -> void {
+        std::unique_lock<std::mutex> lock(memory_blocking);
+        frame += 1;
+        woken += waiting;
+        waiting = 0;
+        frame_ended.notify_all();
+        frame_resumed.wait(lock, [this]() { return woken == 0 || !running; });
+
+        std::vector<char> event;
+        for (auto &[id, watch] : watches) {
+            uint32_t size = watch.last.size();
+            event.resize(13 + size);
+            if (!ReadMemory(watch.address, &event[13], size) ||
+                memcmp(&event[13], watch.last.data(), size) == 0)
+                continue;
+            memcpy(watch.last.data(), &event[13], size);
+            Shared::ToArray<uint32_t>(event.data(), 13 + size, 0);
+            event[4] = Shared::IPC_EVENT;
+            Shared::ToArray<uint32_t>(event.data(), id, 5);
+            Shared::ToArray<uint32_t>(event.data(), watch.address, 9);
+            PushEvent(*subscribers[watch.subscriber], event);
+        }
+    }
+
+    /**
+     * Starts listening for clients. @n
+     * A stale socket left behind at the same path, by a server that is not
+     * running anymore, is removed first.
+     * @return false if the socket cannot be listened to.
+     */
+    auto Start() -> bool {
+        if (running)
+            return true;
+#ifdef _WIN32
+        struct sockaddr_in server;
+
+        sock = socket(AF_INET, SOCK_STREAM, 0);
+        server.sin_family = AF_INET;
+        // localhost only
+        server.sin_addr.s_addr = inet_addr("127.0.0.1");
+        server.sin_port = htons(slot);
+
+        if (bind(sock, (struct sockaddr *)&server, sizeof(server)) < 0 ||
+            listen(sock, SOMAXCONN) < 0) {
+            close_portable(sock);
+            return false;
+        }
+#else
+        struct sockaddr_un server;
+
+        sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        server.sun_family = AF_UNIX;
+        strncpy(server.sun_path, SOCKET_NAME.c_str(), sizeof(server.sun_path));
+        server.sun_path[sizeof(server.sun_path) - 1] = '\0';
+
+        // a server still answering there is not stale
+        if (connect(sock, (struct sockaddr *)&server,
+                    sizeof(struct sockaddr_un)) == 0) {
+            close_portable(sock);
+            return false;
+        }
+        unlink(SOCKET_NAME.c_str());
+        if (bind(sock, (struct sockaddr *)&server,
+                 sizeof(struct sockaddr_un)) < 0 ||
+            listen(sock, SOMAXCONN) < 0) {
+            close_portable(sock);
+            return false;
+        }
+#endif
+        running = true;
+        acceptor = std::thread([this]() { Accept(); });
+        return true;
+    }
+
+    /**
+     * Stops listening and disconnects all clients. @n
+     * Classes overriding the memory or savestate hooks have to call it in
+     * their destructor, as the clients could otherwise still use them.
+     */
+    auto Stop() -> void {
+        if (!running)
+            return;
+        running = false;
+        acceptor.join();
+        close_portable(sock);
+#ifndef _WIN32
+        unlink(SOCKET_NAME.c_str());
+#endif
+        {
+            // wakes up the messages waiting for a frame, and the emulator
+            // waiting for them
+            std::lock_guard<std::mutex> lock(memory_blocking);
+            frame_ended.notify_all();
+            frame_resumed.notify_all();
+        }
+        std::lock_guard<std::mutex> lock(clients_blocking);
+        for (auto &client : clients) {
+            // wakes up the threads blocked on them
+#ifdef _WIN32
+            shutdown(client.sock, SD_BOTH);
+#else
+            shutdown(client.sock, SHUT_RDWR);
+#endif
+        }
+        for (auto &client : clients) {
+            client.thread.join();
+            close_portable(client.sock);
+        }
+        clients.clear();
+    }
+
+    /**
+     * Server Initializer.
+     * @param slot Slot to serve.
+     * @param emulator_name Emulator name to serve.
+     * @param default_slot Whether this is the default slot for the emulator
+     * or not.
+     * @param memory_size Size of the emulated memory.
+     * @see Shared::Shared
+     */
+    Server(const unsigned int slot, const std::string emulator_name,
+           const bool default_slot, const size_t memory_size)
+        : memory(memory_size) {
+        this->slot = slot;
+#ifdef _WIN32
+        // We initialize winsock.
+        WSADATA wsa;
+        WSAStartup(MAKEWORD(2, 2), &wsa);
+#else
+        SOCKET_NAME = Shared::SocketPath(slot, emulator_name, default_slot);
+#endif
+    }
+
+    /**
+     * Server Destructor.
+     */
+    virtual ~Server() {
+        Stop();
+        // We clean up winsock.
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+
+    /**
+     * Disable the copy constructor.
+     */
+    Server(const Server &rhs) = delete;
+
+    /**
+     * Disable the move constructor.
+     */
+    Server(Server &&rhs) = delete;
+
+    /**
+     * Disable the copy assignment operator.
+     */
+    Server &operator=(const Server &rhs) = delete;
+
+    /**
+     * Disable the move assignment operator.
+     */
+    Server &operator=(Server &&rhs) = delete;
+};
+
+class PCSX2Server : public Server {
+  public:
+    /**
+     * PCSX2 server Initializer with a specified slot.
+     * @param slot Slot to serve, same as the PCSX2 client.
+     * @param memory_size Size of the emulated memory, 32MiB of EE RAM by
+     * default.
+     * @see PCSX2
+     */
+    PCSX2Server(const unsigned int slot = 0,
+                const size_t memory_size = 32 * 1024 * 1024)
+        : Server((slot == 0) ? PCSX2::DEFAULT_SLOT : slot,
+                 PCSX2::EMULATOR_NAME, (slot == 0), memory_size) {
+        version = "PCSX2 PINE reference server";
+    }
+
+    /**
+     * PCSX2 server Destructor. @n
+     * Clients are stopped before they can call into a destroyed class.
+     */
+    ~PCSX2Server() { Stop(); }
+};
+
+class RPCS3Server : public Server {
+  public:
+    /**
+     * RPCS3 server Initializer with a specified slot.
+     * @param slot Slot to serve, same as the RPCS3 client.
+     * @param memory_size Size of the emulated memory.
+     * @see RPCS3
+     */
+    RPCS3Server(const unsigned int slot = 0,
+                const size_t memory_size = 256 * 1024 * 1024)
+        : Server((slot == 0) ? RPCS3::DEFAULT_SLOT : slot,
+                 RPCS3::EMULATOR_NAME, (slot == 0), memory_size) {
+        version = "RPCS3 PINE reference server";
+    }
+
+    /**
+     * RPCS3 server Destructor. @n
+     * Clients are stopped before they can call into a destroyed class.
+     */
+    ~RPCS3Server() { Stop(); }
+};
+
+class DuckStationServer : public Server {
+  public:
+    /**
+     * DuckStation server Initializer with a specified slot.
+     * @param slot Slot to serve, same as the DuckStation client.
+     * @param memory_size Size of the emulated memory, 2MiB of RAM by default.
+     * @see DuckStation
+     */
+    DuckStationServer(const unsigned int slot = 0,
+                      const size_t memory_size = 2 * 1024 * 1024)
+        : Server((slot == 0) ? DuckStation::DEFAULT_SLOT : slot,
+                 DuckStation::EMULATOR_NAME, (slot == 0), memory_size) {
+        version = "DuckStation PINE reference server";
+    }
+
+    /**
+     * DuckStation server Destructor. @n
+     * Clients are stopped before they can call into a destroyed class.
+     */
+    ~DuckStationServer() { Stop(); }
+};
+
+}; // namespace PINE
@@ -1,7 +1,17 @@
 #include "pine.h"
+#include "pine_async.h"
+#include "pine_mirror.h"
+#include "pine_pnach.h"
+#include "pine_scanner.h"
+#include "pine_server.h"
 #define CATCH_CONFIG_MAIN
+#include <algorithm>
+#include <atomic>
 #include <catch2/catch.hpp>
 #include <climits>
+#include <memory>
+#include <sstream>
+#include <vector>
 
 #define u8 uint8_t
 #define u16 uint16_t
@@ -13,6 +23,8 @@
  * You will probably need to set environment variables to be able
  * to boot emulator(s) with some ISO for all of this to run. Refer to
  * utils/default.nix for an example on how to do that.
+ * Without PCSX2_TEST set, the tests run against the reference server
+ * instead.
  */
 
 // a portable sleep function
@@ -58,6 +70,13 @@ SCENARIO("PCSX2 can be interacted with remotely through IPC", "[pine]") {
 
         open_pcsx2();
 
+        // no emulator to test against, the reference server stands in for it
+        std::unique_ptr<PINE::PCSX2Server> server;
+        if (!std::getenv("PCSX2_TEST")) {
+            server = std::make_unique<PINE::PCSX2Server>();
+            REQUIRE(server->Start());
+        }
+
         // we wait for PCSX2 to be reachable within 10 seconds.
         {
             PINE::PCSX2 check;
@@ -138,6 +157,737 @@ SCENARIO("PCSX2 can be interacted with remotely through IPC", "[pine]") {
             }
         }
 
+        WHEN("We want to read/write memory blocks") {
+            THEN("The block read/writes are consistent") {
+
+                // we write a block, read it back both directly and in batch
+                // mode, and ensure it round-trips.
+                REQUIRE_NOTHROW([&]() {
+                    PINE::PCSX2 ipc;
+                    u8 block[4096];
+                    u8 readback[4096] = {};
+                    for (int i = 0; i < 4096; i++)
+                        block[i] = (u8)(i * 7);
+
+                    ipc.WriteRange(0x00348000, block, sizeof(block));
+                    ipc.ReadRange(0x00348000, sizeof(readback), readback);
+                    REQUIRE(memcmp(block, readback, sizeof(block)) == 0);
+
+                    ipc.InitializeBatch();
+                    ipc.Write<u8, true>(0x00348000, 0xAB);
+                    ipc.ReadRange<true>(0x00348000, 16);
+                    ipc.Read<u8, true>(0x00348010);
+                    auto resr = ipc.FinalizeBatch();
+                    ipc.SendCommand(resr);
+
+                    char *range =
+                        ipc.GetReply<PINE::PCSX2::MsgReadRange>(resr, 1);
+                    REQUIRE((u8)range[0] == 0xAB);
+                    REQUIRE(memcmp(&range[1], &block[1], 15) == 0);
+                    REQUIRE(ipc.GetReply<PINE::PCSX2::MsgRead8>(resr, 2) ==
+                            block[16]);
+                }());
+            }
+        }
+
+        WHEN("We want to mirror memory locally") {
+            THEN("Reads are served from the last refresh") {
+
+                // the mirror only sees writes of others after a refresh,
+                // while its own go through to the emulator.
+                REQUIRE_NOTHROW([&]() {
+                    PINE::PCSX2 ipc;
+                    PINE::MemoryMirror mirror(ipc);
+                    ipc.Write<u32>(0x00350010, 0xCAFE);
+                    mirror.Mirror(0x00350010, 4);
+                    mirror.Mirror(0x00351000, 0x40000);
+                    REQUIRE(mirror.Refresh() == 1);
+                    REQUIRE(mirror.Read<u32>(0x00350010) == 0xCAFE);
+
+                    ipc.Write<u32>(0x00350010, 0xBEEF);
+                    REQUIRE(mirror.Read<u32>(0x00350010) == 0xCAFE);
+                    REQUIRE(mirror.Refresh() == 2);
+                    REQUIRE(mirror.Read<u32>(0x00350010) == 0xBEEF);
+
+                    mirror.Write<u32>(0x00390FFE, 0x12345678);
+                    REQUIRE(mirror.Read<u16>(0x00390FFE) == 0x5678);
+                    REQUIRE(mirror.Read<u32>(0x00390FFE) == 0x12345678);
+                    REQUIRE(ipc.Read<u32>(0x00390FFE) == 0x12345678);
+                }());
+            }
+        }
+
+        WHEN("We want to search memory for a variable") {
+            THEN("Successive scans narrow the candidates down") {
+
+                // we plant a few values in an otherwise untouched range,
+                // then change them the way a game would.
+                REQUIRE_NOTHROW([&]() {
+                    using Scanner = PINE::Scanner<u32>;
+                    PINE::PCSX2 ipc;
+                    for (u32 i = 0; i < 8; i++)
+                        ipc.Write<u32>(0x00400000 + i * 0x8000, 0x1337);
+                    Scanner scan(ipc, 0x00400000, 0x100000);
+                    REQUIRE(scan.Count() == 0x100000 / 4);
+                    REQUIRE(scan.Scan(Scanner::Equal, 0x1337) == 8);
+
+                    ipc.Write<u32>(0x00408000, 0x1336);
+                    ipc.Write<u32>(0x00418000, 0x1338);
+                    REQUIRE(scan.Scan(Scanner::Decreased) == 1);
+                    REQUIRE(scan.Candidates() ==
+                            std::vector<u32>{ 0x00408000 });
+                    REQUIRE(scan.Value(0x00408000) == 0x1336);
+                    REQUIRE(scan.Scan(Scanner::Changed) == 0);
+
+                    REQUIRE(scan.Reset() == 0x100000 / 4);
+                    ipc.Write<u32>(0x004FFFFC, 0x42);
+                    REQUIRE(scan.Scan(Scanner::Changed) == 1);
+                    REQUIRE(scan.Candidates()[0] == 0x004FFFFC);
+                }());
+            }
+        }
+
+        WHEN("We want to communicate with PCSX2 from multiple threads") {
+            THEN("Pooled connections do not step on each others") {
+
+                // every thread gets its own connection and batch builder, so
+                // their read/writes and batches interleave without issues.
+                struct Client : PINE::PCSX2 {
+                    using PINE::PCSX2::PCSX2;
+                    auto Pooled() {
+                        std::lock_guard<std::mutex> lock(pool_blocking);
+                        return pool.size();
+                    }
+                };
+                Client ipc(0, PINE::PCSX2::ConnectionPool);
+                std::atomic<int> failures = 0;
+                std::vector<std::thread> workers;
+                for (int t = 0; t < 4; t++) {
+                    workers.emplace_back([&, t]() {
+                        try {
+                            u32 address = 0x00347F34 + t * 4;
+                            for (u32 i = 0; i < 100; i++) {
+                                ipc.Write<u32>(address, i);
+                                if (ipc.Read<u32>(address) != i)
+                                    failures++;
+                            }
+                            ipc.InitializeBatch();
+                            ipc.Write<u32, true>(address, 0xCAFE + t);
+                            ipc.Read<u32, true>(address);
+                            auto resr = ipc.FinalizeBatch();
+                            ipc.SendCommand(resr);
+                            if (ipc.GetReply<PINE::PCSX2::MsgRead32>(resr, 1) !=
+                                (u32)(0xCAFE + t))
+                                failures++;
+                        } catch (...) {
+                            failures++;
+                        }
+                    });
+                }
+                for (auto &worker : workers)
+                    worker.join();
+                REQUIRE(failures == 0);
+
+                // connections go away with their thread, even one leaving in
+                // the middle of a batch, for the next ones to start afresh
+                REQUIRE(ipc.Pooled() == 0);
+                std::thread([&]() {
+                    ipc.InitializeBatch();
+                    ipc.Read<u32, true>(0x00347F34);
+                }).join();
+                REQUIRE(ipc.Pooled() == 0);
+                for (int t = 0; t < 8; t++) {
+                    std::thread([&]() {
+                        try {
+                            ipc.InitializeBatch();
+                            ipc.Read<u32, true>(0x00347F34);
+                            auto resr = ipc.FinalizeBatch();
+                            ipc.SendCommand(resr);
+                        } catch (...) {
+                            failures++;
+                        }
+                    }).join();
+                }
+                REQUIRE(failures == 0);
+                REQUIRE(ipc.Pooled() == 0);
+            }
+        }
+
+#ifdef __linux__
+        WHEN("We want to communicate with PCSX2 asynchronously") {
+            THEN("A single thread drives multiple sessions") {
+
+                // two tasks per session, their commands take turns on the
+                // connection while the sessions run concurrently.
+                PINE::EventLoop loop;
+                std::vector<std::unique_ptr<PINE::Async<PINE::PCSX2>>> ipcs;
+                for (int i = 0; i < 8; i++)
+                    ipcs.push_back(
+                        std::make_unique<PINE::Async<PINE::PCSX2>>(loop));
+                int failures = 0;
+                auto worker = [&](PINE::Async<PINE::PCSX2> &ipc,
+                                  u32 t) -> PINE::Task<void> {
+                    u32 address = 0x00347FB4 + t * 4;
+                    for (u32 i = 0; i < 100; i++) {
+                        co_await ipc.Write<u32>(address, i);
+                        if (co_await ipc.Read<u32>(address) != i)
+                            failures++;
+                    }
+                    ipc.InitializeBatch();
+                    ipc.Write<u32, true>(address, 0xCAFE + t);
+                    ipc.Read<u32, true>(address);
+                    auto resr = ipc.FinalizeBatch();
+                    co_await ipc.Send(resr);
+                    if (ipc.GetReply<PINE::PCSX2::MsgRead32>(resr, 1) !=
+                        (u32)(0xCAFE + t))
+                        failures++;
+                };
+                for (u32 t = 0; t < 16; t++)
+                    loop.Spawn(worker(*ipcs[t % 8], t));
+                REQUIRE_NOTHROW(loop.Run());
+                REQUIRE(failures == 0);
+                REQUIRE(loop.Run(ipcs[0]->Read<u32>(0x00347FB4)) == 0xCAFE);
+            }
+        }
+
+        WHEN("We want to communicate with multiple PCSX2 at once") {
+            THEN("A batch is sent to all of them") {
+
+                // our own instances, on slots of their own.
+                std::vector<std::unique_ptr<PINE::PCSX2Server>> farm;
+                std::vector<unsigned int> slots;
+                for (unsigned int i = 0; i < 4; i++) {
+                    farm.push_back(std::make_unique<PINE::PCSX2Server>(
+                        28100 + i, 1024 * 1024));
+                    REQUIRE(farm.back()->Start());
+                    slots.push_back(28100 + i);
+                    PINE::PCSX2(28100 + i).Write<u32>(0x1000, 0xA0 + i);
+                }
+                slots.push_back(28199);
+
+                PINE::EventLoop loop;
+                PINE::Fleet<PINE::PCSX2> fleet(loop, slots);
+                fleet.InitializeBatch();
+                fleet.Version<true>();
+                fleet.Read<u32, true>(0x1000);
+                auto resr = fleet.FinalizeBatch();
+                auto results = loop.Run(fleet.Broadcast(resr));
+                REQUIRE(results.size() == 5);
+                for (unsigned int i = 0; i < 4; i++) {
+                    REQUIRE(results[i].slot == 28100 + i);
+                    REQUIRE(results[i].status == PINE::PCSX2::Success);
+                    REQUIRE(fleet.GetReply<PINE::PCSX2::MsgRead32>(
+                                results[i].reply, 1) == 0xA0 + i);
+                }
+                REQUIRE(results[4].status == PINE::PCSX2::NoConnection);
+            }
+        }
+#endif
+
+        WHEN("PCSX2 takes too long to reply") {
+            THEN("Commands time out instead of blocking") {
+
+                // an instance stuck on savestates
+                struct Stuck : PINE::PCSX2Server {
+                    using PINE::PCSX2Server::PCSX2Server;
+                    ~Stuck() { Stop(); }
+                    auto SaveState(uint8_t) -> bool override {
+                        msleep(300);
+                        return true;
+                    }
+                };
+                Stuck stuck(28120, 1024 * 1024);
+                REQUIRE(stuck.Start());
+                struct Client : PINE::PCSX2 {
+                    using PINE::PCSX2::PCSX2;
+                    auto Socket() { return Conn().sock; }
+                    auto RetryAt() { return Conn().retry_at; }
+                    auto BackOff(std::chrono::milliseconds delay) {
+                        Conn().retry_at =
+                            std::chrono::steady_clock::now() + delay;
+                    }
+                };
+                Client ipc(28120);
+                auto status = [&](auto &&f) {
+                    try {
+                        f();
+                    } catch (PINE::PCSX2::IPCStatus err) {
+                        return err;
+                    }
+                    return PINE::PCSX2::Success;
+                };
+
+                ipc.SetTimeout(50);
+                auto start = std::chrono::steady_clock::now();
+                REQUIRE(status([&]() { ipc.SaveState(1); }) ==
+                        PINE::PCSX2::Timeout);
+                REQUIRE(std::chrono::steady_clock::now() - start <
+                        std::chrono::milliseconds(250));
+                // we back off for a bit before connecting again, without
+                // writing to the old descriptor, which could be anything by
+                // now: stretched here to not depend on how fast we are
+                REQUIRE(ipc.RetryAt() > start);
+                REQUIRE(ipc.Socket() == invalid_socket_portable);
+                ipc.BackOff(std::chrono::hours(1));
+                REQUIRE(status([&]() { ipc.Read<u32>(0x1000); }) ==
+                        PINE::PCSX2::NoConnection);
+                REQUIRE(ipc.Socket() == invalid_socket_portable);
+                // and connect again once done, waiting for the savestate
+                ipc.SetTimeout(-1);
+                ipc.BackOff(std::chrono::milliseconds(0));
+                REQUIRE(status([&]() { ipc.Read<u32>(0x1000); }) ==
+                        PINE::PCSX2::Success);
+
+                PINE::PCSX2::Deadline deadline(std::chrono::milliseconds(50));
+                REQUIRE(status([&]() { ipc.SaveState(1); }) ==
+                        PINE::PCSX2::Timeout);
+            }
+        }
+
+#ifndef _WIN32
+        WHEN("PCSX2 stops in the middle of an event") {
+            THEN("The session does not wait for the rest of it forever") {
+
+                // an emulator going quiet after the header of an event
+                struct Client : PINE::PCSX2 {
+                    using PINE::PCSX2::PCSX2;
+                    static auto Path(unsigned int slot) {
+                        return SocketPath(slot, "pcsx2", false);
+                    }
+                };
+                std::string path = Client::Path(28121);
+                unlink(path.c_str());
+                int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+                struct sockaddr_un addr = {};
+                addr.sun_family = AF_UNIX;
+                strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+                REQUIRE(bind(listener, (struct sockaddr *)&addr,
+                             sizeof(addr)) == 0);
+                REQUIRE(listen(listener, 2) == 0);
+
+                std::atomic<bool> done = false;
+                std::thread emulator([&]() {
+                    // every request gets 1 as a reply
+                    auto reply = [](int fd) {
+                        char request[64];
+                        char ok[9] = { 9, 0, 0, 0, 0, 1, 0, 0, 0 };
+                        if (read(fd, request, sizeof(request)) > 0)
+                            send(fd, ok, sizeof(ok), MSG_NOSIGNAL);
+                    };
+                    int session = accept(listener, nullptr, nullptr);
+                    int stream = accept(listener, nullptr, nullptr);
+                    reply(stream);
+                    reply(session);
+                    char header[5] = { 20, 0, 0, 0, 1 };
+                    send(stream, header, sizeof(header), MSG_NOSIGNAL);
+                    while (!done)
+                        msleep(10);
+                    close(stream);
+                    close(session);
+                });
+
+                auto start = std::chrono::steady_clock::now();
+                {
+                    Client ipc(28121);
+                    PINE::PCSX2::WatchEvent event;
+                    REQUIRE(ipc.Watch(0x00347F84, 4) == 1);
+                    REQUIRE(!ipc.NextEvent(event, 5000));
+                }
+                REQUIRE(std::chrono::steady_clock::now() - start <
+                        std::chrono::milliseconds(EVENT_READ_TIMEOUT + 2000));
+                done = true;
+                emulator.join();
+                close(listener);
+                unlink(path.c_str());
+            }
+        }
+#endif
+
+#ifndef _WIN32
+        WHEN("We want to find running emulators") {
+            THEN("Their sockets are discovered") {
+                auto endpoints = PINE::PCSX2::Discover();
+                REQUIRE(std::any_of(
+                    endpoints.begin(), endpoints.end(), [](auto &endpoint) {
+                        return endpoint.emulator == "pcsx2" &&
+                               endpoint.slot == 0 &&
+                               endpoint.status == PINE::PCSX2::Live;
+                    }));
+            }
+#ifdef __linux__
+            THEN("New ones are noticed and attached to lazily") {
+                // a runtime directory we cannot watch is reported
+                {
+                    const char *env = std::getenv("XDG_RUNTIME_DIR");
+                    std::string runtime_dir = env ? env : "";
+                    setenv("XDG_RUNTIME_DIR", "/nonexistent/pine", 1);
+                    PINE::PCSX2::SocketWatcher missing;
+                    if (env)
+                        setenv("XDG_RUNTIME_DIR", runtime_dir.c_str(), 1);
+                    else
+                        unsetenv("XDG_RUNTIME_DIR");
+                    PINE::PCSX2::Endpoint endpoint;
+                    REQUIRE(!missing.Ok());
+                    REQUIRE(!missing.Next(endpoint));
+                }
+
+                PINE::PCSX2::SocketWatcher watcher;
+                REQUIRE(watcher.Ok());
+                PINE::PCSX2 ipc(28110, PINE::PCSX2::LazyConnect);
+                PINE::PCSX2Server instance(28110, 1024 * 1024);
+                REQUIRE(instance.Start());
+                PINE::PCSX2::Endpoint endpoint;
+                REQUIRE(watcher.Next(endpoint, 1000));
+                REQUIRE(endpoint.slot == 28110);
+                // it might not be listening yet when we hear of it
+                REQUIRE((endpoint.status == PINE::PCSX2::Live ||
+                         endpoint.status == PINE::PCSX2::Created));
+                for (int i = 0; i < 100 && endpoint.status != PINE::PCSX2::Live;
+                     i++) {
+                    msleep(1);
+                    endpoint.status = PINE::PCSX2::Probe(endpoint.path);
+                }
+                REQUIRE(endpoint.status == PINE::PCSX2::Live);
+                REQUIRE_NOTHROW(ipc.Write<u32>(0x1000, 0xD15C));
+                REQUIRE(ipc.Read<u32>(0x1000) == 0xD15C);
+                instance.Stop();
+                REQUIRE(watcher.Next(endpoint, 1000));
+                REQUIRE(endpoint.slot == 28110);
+                REQUIRE(endpoint.status == PINE::PCSX2::Gone);
+            }
+#endif
+        }
+#endif
+
+        WHEN("We want to communicate with PCSX2 through shared memory") {
+            THEN("It works, or falls back to the socket if unsupported") {
+                REQUIRE_NOTHROW([&]() {
+                    PINE::PCSX2 ipc(0, PINE::PCSX2::SharedMemory);
+                    ipc.Write<u32>(0x00347F74, 0xBEEF);
+                    REQUIRE(ipc.Read<u32>(0x00347F74) == 0xBEEF);
+                    ipc.InitializeBatch();
+                    ipc.Version<true>();
+                    ipc.Read<u32, true>(0x00347F74);
+                    auto resr = ipc.FinalizeBatch();
+                    ipc.SendCommand(resr);
+                    REQUIRE(ipc.GetReply<PINE::PCSX2::MsgRead32>(resr, 1) ==
+                            0xBEEF);
+                }());
+            }
+        }
+
+        WHEN("We want to communicate with PCSX2 through io_uring") {
+            THEN("It works, or falls back to the socket if unsupported") {
+                REQUIRE_NOTHROW([&]() {
+                    PINE::PCSX2 ipc(0, PINE::PCSX2::IoUring);
+                    ipc.Write<u32>(0x00347F78, 0xF00D);
+                    REQUIRE(ipc.Read<u32>(0x00347F78) == 0xF00D);
+                    ipc.InitializeBatch();
+                    ipc.Version<true>();
+                    ipc.Read<u32, true>(0x00347F78);
+                    auto resr = ipc.FinalizeBatch();
+                    ipc.SendCommand(resr);
+                    REQUIRE(ipc.GetReply<PINE::PCSX2::MsgRead32>(resr, 1) ==
+                            0xF00D);
+                    ipc.InitializeBatch();
+                    for (int i = 0; i < 60000; i++)
+                        ipc.Read<u32, true>(0x00347F78);
+                    auto split = ipc.FinalizeBatch();
+                    ipc.SendCommand(split);
+                    REQUIRE(ipc.GetReply<PINE::PCSX2::MsgRead32>(
+                                split, 59999) == 0xF00D);
+                }());
+            }
+        }
+
+        WHEN("We want to be notified of memory changes") {
+            THEN("Changes are pushed at the end of the frame") {
+
+                // only the reference server implements watches so far, and
+                // we need to be the one ending its frames.
+                if (server) {
+                    REQUIRE_NOTHROW([&]() {
+                        PINE::PCSX2 ipc;
+                        PINE::PCSX2::WatchEvent event;
+                        ipc.Write<u32>(0x00347F84, 0);
+                        u32 id = ipc.Watch(0x00347F84, 4);
+                        server->Frame();
+                        REQUIRE(!ipc.NextEvent(event, 100));
+
+                        ipc.Write<u32>(0x00347F84, 0xC0FFEE);
+                        server->Frame();
+                        REQUIRE(ipc.NextEvent(event, 1000));
+                        REQUIRE(event.id == id);
+                        REQUIRE(event.address == 0x00347F84);
+                        REQUIRE(event.data.size() == 4);
+                        u32 value;
+                        memcpy(&value, event.data.data(), sizeof(value));
+                        REQUIRE(value == 0xC0FFEE);
+
+                        // batched this time, with events going to a callback
+                        std::atomic<int> seen = 0;
+                        std::atomic<int> stale = 0;
+                        ipc.OnWatch([&](const PINE::PCSX2::WatchEvent &e) {
+                            (e.id == id) ? stale++ : seen++;
+                        });
+                        ipc.InitializeBatch();
+                        ipc.Watch<true>(0x00347F88, 8);
+                        ipc.Unwatch<true>(id);
+                        auto resr = ipc.FinalizeBatch();
+                        ipc.SendCommand(resr);
+                        REQUIRE(ipc.GetReply<PINE::PCSX2::MsgWatch>(resr, 0) !=
+                                id);
+                        ipc.Write<u64>(0x00347F88, 1);
+                        ipc.Write<u32>(0x00347F84, 1);
+                        server->Frame();
+                        for (int i = 0; i < 100 && seen == 0; i++)
+                            msleep(10);
+                        REQUIRE(seen == 1);
+                        REQUIRE(stale == 0);
+                        REQUIRE_THROWS(ipc.Unwatch(id));
+                    }());
+
+#ifndef _WIN32
+                    // stored batches follow the event connection being
+                    // opened again once patched
+                    struct Client : PINE::PCSX2 {
+                        // taken under the lock the reader queues events
+                        // under, for the socket to be read before the reader
+                        // closes it once it queued one
+                        auto EventSocket() {
+                            std::lock_guard<std::mutex> lock(
+                                events.queue_blocking);
+                            return events.conn->sock;
+                        }
+                    };
+                    Client ipc;
+                    PINE::PCSX2::WatchEvent event;
+                    PINE::PCSX2::BatchSlot<u32> subscriber;
+                    ipc.InitializeBatch();
+                    ipc.Watch<true>(0x00347F90, 4, &subscriber);
+                    auto watch = ipc.FinalizeBatch();
+                    REQUIRE_NOTHROW(ipc.SendCommand(watch));
+                    u32 first = ipc.Subscriber();
+                    auto sock = ipc.EventSocket();
+                    ipc.Write<u32>(0x00347F90, 0xBEEF);
+                    server->Frame();
+                    REQUIRE(ipc.NextEvent(event, 1000));
+                    shutdown(sock, SHUT_RDWR);
+                    REQUIRE(!ipc.NextEvent(event, 1000));
+                    REQUIRE(ipc.Subscriber() != first);
+                    REQUIRE_THROWS(ipc.SendCommand(watch));
+                    PINE::PCSX2::Patch(watch, subscriber, ipc.Subscriber());
+                    REQUIRE_NOTHROW(ipc.SendCommand(watch));
+                    ipc.Write<u32>(0x00347F90, 0xFEED);
+                    server->Frame();
+                    REQUIRE(ipc.NextEvent(event, 1000));
+                    REQUIRE(event.address == 0x00347F90);
+#endif
+                }
+            }
+        }
+
+        WHEN("We want to run commands at the end of a frame") {
+            THEN("They run once per frame") {
+
+                // only the reference server implements it so far, we end its
+                // frames at a few hundred fps.
+                if (server) {
+                    std::jthread vblank([&](std::stop_token stop) {
+                        while (!stop.stop_requested()) {
+                            server->Frame();
+                            msleep(2);
+                        }
+                    });
+                    REQUIRE_NOTHROW([&]() {
+                        PINE::PCSX2 ipc;
+                        u32 frame = ipc.ExecuteOnFrameEnd();
+                        ipc.InitializeBatch();
+                        ipc.ExecuteOnFrameEnd<true>();
+                        ipc.Write<u32, true>(0x00347F94, 0xF00D);
+                        ipc.Read<u32, true>(0x00347F94);
+                        auto resr = ipc.FinalizeBatch();
+                        for (int i = 0; i < 3; i++) {
+                            ipc.SendCommand(resr);
+                            u32 next =
+                                ipc.GetReply<PINE::PCSX2::MsgFrameEnd>(resr, 0);
+                            REQUIRE(next > frame);
+                            frame = next;
+                            REQUIRE(ipc.GetReply<PINE::PCSX2::MsgRead32>(
+                                        resr, 2) == 0xF00D);
+                        }
+                    }());
+                }
+            }
+        }
+
+        WHEN("We want to modify values in memory") {
+            THEN("The emulator applies the operations in place") {
+
+                // only the reference server implements it so far.
+                if (server) {
+                    REQUIRE_NOTHROW([&]() {
+                        PINE::PCSX2 ipc;
+                        ipc.Write<u64>(0x00360300, 0x00000000FFFFFFFF);
+                        REQUIRE(ipc.Modify<u8>(0x00360300, PINE::PCSX2::Add,
+                                               2) == 0xFF);
+                        REQUIRE(ipc.Read<u8>(0x00360300) == 1);
+                        REQUIRE(ipc.Modify<u16>(0x00360304, PINE::PCSX2::Sub,
+                                                1) == 0);
+                        REQUIRE(ipc.Read<u16>(0x00360304) == 0xFFFF);
+                        REQUIRE(ipc.Modify<u64>(0x00360300, PINE::PCSX2::Add,
+                                                0x100) == 0x0000FFFFFFFFFF01);
+                        REQUIRE(ipc.Read<u64>(0x00360300) ==
+                                0x0001000000000001);
+
+                        ipc.InitializeBatch();
+                        ipc.Modify<u32, true>(0x00360300, PINE::PCSX2::Clear,
+                                              0xFF00);
+                        ipc.Modify<u32, true>(0x00360300, PINE::PCSX2::Xor, 3);
+                        ipc.Modify<u32, true>(0x00360300, PINE::PCSX2::Or,
+                                              0x10);
+                        ipc.Modify<u32, true>(0x00360300, PINE::PCSX2::And,
+                                              0xF0);
+                        auto resr = ipc.FinalizeBatch();
+                        ipc.SendCommand(resr);
+                        REQUIRE(ipc.GetReply<PINE::PCSX2::MsgModify32>(
+                                    resr, 0) == 1);
+                        REQUIRE(ipc.GetReply<PINE::PCSX2::MsgModify32>(
+                                    resr, 2) == 2);
+                        REQUIRE(ipc.Read<u32>(0x00360300) == 0x10);
+                    }());
+                }
+            }
+        }
+
+        WHEN("We want to execute commands conditionally") {
+            THEN("The emulator skips the blocks whose condition fails") {
+
+                // only the reference server implements it so far. skipped
+                // replies are zeroed, leaving the following ones in place.
+                if (server) {
+                    REQUIRE_NOTHROW([&]() {
+                        PINE::PCSX2 ipc;
+                        ipc.Write<u32>(0x00360400, 7);
+                        ipc.Write<u64>(0x00360404, 0);
+                        ipc.InitializeBatch();
+                        ipc.BeginIf<u32>(0x00360400, PINE::PCSX2::Equal, 7);
+                        ipc.Write<u32, true>(0x00360404, 1);
+                        ipc.BeginIf<u16>(0x00360400, PINE::PCSX2::Greater, 7);
+                        ipc.Write<u32, true>(0x00360408, 1);
+                        ipc.Version<true>();
+                        ipc.ReadRange<true>(0x00360400, 8);
+                        ipc.EndIf();
+                        ipc.Read<u32, true>(0x00360400);
+                        ipc.EndIf();
+                        ipc.BeginIf<u8>(0x00360400, PINE::PCSX2::Less, 7);
+                        ipc.Modify<u32, true>(0x00360400, PINE::PCSX2::Add, 1);
+                        ipc.EndIf();
+                        ipc.Read<u32, true>(0x00360400);
+                        auto resr = ipc.FinalizeBatch();
+                        ipc.SendCommand(resr);
+
+                        REQUIRE(ipc.GetReply<PINE::PCSX2::MsgRead8>(resr, 0) ==
+                                1);
+                        REQUIRE(ipc.GetReply<PINE::PCSX2::MsgRead8>(resr, 2) ==
+                                0);
+                        REQUIRE(ipc.GetReplyView<PINE::PCSX2::MsgVersion>(
+                                    resr, 4) == "");
+                        char *range =
+                            ipc.GetReply<PINE::PCSX2::MsgReadRange>(resr, 5);
+                        REQUIRE(std::all_of(range, range + 8,
+                                            [](char c) { return c == 0; }));
+                        REQUIRE(ipc.GetReply<PINE::PCSX2::MsgRead32>(resr, 6) ==
+                                7);
+                        REQUIRE(ipc.GetReply<PINE::PCSX2::MsgRead8>(resr, 7) ==
+                                0);
+                        REQUIRE(ipc.GetReply<PINE::PCSX2::MsgRead32>(resr, 9) ==
+                                7);
+                        REQUIRE(ipc.Read<u32>(0x00360404) == 1);
+                        REQUIRE(ipc.Read<u32>(0x00360408) == 0);
+                    }());
+                }
+            }
+        }
+
+        WHEN("We want to read a value behind pointers") {
+            THEN("The emulator follows them in a single round trip") {
+
+                // only the reference server implements it so far.
+                if (server) {
+                    REQUIRE_NOTHROW([&]() {
+                        PINE::PCSX2 ipc;
+                        ipc.Write<u32>(0x00360000, 0x00360100);
+                        ipc.Write<u32>(0x00360110, 0x00360200);
+                        ipc.Write<u32>(0x00360248, 0xDEADBEEF);
+                        REQUIRE(ipc.ReadPointerChain<u32>(0x00360000, 0x10,
+                                                          0x48) == 0xDEADBEEF);
+                        REQUIRE(ipc.ReadPointerChain<u16>(0x00360248) ==
+                                0xBEEF);
+
+                        ipc.InitializeBatch();
+                        ipc.ReadPointerChain<u8, true>(0x00360000, 0x10, 0x48);
+                        ipc.ReadPointerChain<u32, true>(0x00360000, 0x10);
+                        auto resr = ipc.FinalizeBatch();
+                        ipc.SendCommand(resr);
+                        REQUIRE(ipc.GetReply<PINE::PCSX2::MsgRead8>(resr, 0) ==
+                                0xEF);
+                        REQUIRE(ipc.GetReply<PINE::PCSX2::MsgRead32>(
+                                    resr, 1) == 0x00360200);
+                    }());
+                    PINE::PCSX2 ipc;
+                    ipc.Write<u32>(0x00360110, 0xFFFFFF00);
+                    REQUIRE_THROWS(
+                        ipc.ReadPointerChain<u32>(0x00360000, 0x10, 0x48));
+                }
+            }
+        }
+
+        WHEN("We want to apply a pnach file") {
+            THEN("Its codes are applied with a single batch command") {
+
+                // tests and modifications need the reference server.
+                if (server) {
+                    REQUIRE_NOTHROW([&]() {
+                        std::istringstream file(
+                            "gametitle=Test\n"
+                            "patch=1,EE,00360600,word,12345678 // life\n"
+                            "patch=1,EE,00360604,short,9ABC\n"
+                            "patch=1,EE,00360606,byte,DE\n"
+                            "patch=0,EE,20360610,extended,00000001\n"
+                            "patch=1,EE,E0020005,extended,00360600\n"
+                            "patch=1,EE,00360614,word,00000001\n"
+                            "patch=1,EE,30000001,extended,00360618\n"
+                            "patch=1,EE,E1010007,extended,10360618\n"
+                            "patch=1,EE,3010000A,extended,00360618\n"
+                            "patch=1,EE,70360620,extended,00100F00\n"
+                            "patch=1,EE,60360630,extended,00000001\n");
+                        PINE::Pnach pnach(file);
+                        REQUIRE(pnach.Unsupported() == 1);
+
+                        PINE::PCSX2 ipc;
+                        ipc.Write<u32>(0x00360610, 0);
+                        ipc.Write<u32>(0x00360614, 0);
+                        ipc.Write<u32>(0x00360618, 0);
+                        ipc.Write<u16>(0x00360620, 0);
+                        auto resr = pnach.Compile(ipc);
+                        ipc.SendCommand(resr);
+                        ipc.SendCommand(resr);
+                        REQUIRE(ipc.Read<u64>(0x00360600) ==
+                                0xDE9ABC12345678);
+                        REQUIRE(ipc.Read<u32>(0x00360610) == 0);
+                        REQUIRE(ipc.Read<u32>(0x00360614) == 0);
+                        REQUIRE(ipc.Read<u8>(0x00360618) == 0xEC);
+                        REQUIRE(ipc.Read<u16>(0x00360620) == 0x0F00);
+
+                        auto once = pnach.Compile(ipc, true);
+                        ipc.SendCommand(once);
+                        REQUIRE(ipc.Read<u32>(0x00360610) == 1);
+                    }());
+                }
+            }
+        }
+
         WHEN("We want to know PCSX2 Version") {
             THEN("It returns a correct one") {
 
@@ -149,6 +899,29 @@ SCENARIO("PCSX2 can be interacted with remotely through IPC", "[pine]") {
                     REQUIRE(strncmp(version, "PCSX2", 5) == 0);
                 }());
             }
+
+            THEN("It can be read without allocating") {
+
+                // we read it in our own buffers, including one too small, and
+                // straight from a batch reply.
+                REQUIRE_NOTHROW([&]() {
+                    PINE::PCSX2 ipc;
+                    char version[256];
+                    char small[4];
+                    size_t len = ipc.Version(version, sizeof(version));
+                    REQUIRE(len == strlen(version));
+                    REQUIRE(strncmp(version, "PCSX2", 5) == 0);
+                    REQUIRE(ipc.Version(small, sizeof(small)) == len);
+                    REQUIRE(strcmp(small, "PCS") == 0);
+
+                    ipc.InitializeBatch();
+                    ipc.Version<true>();
+                    auto resr = ipc.FinalizeBatch();
+                    ipc.SendCommand(resr);
+                    REQUIRE(ipc.GetReplyView<PINE::PCSX2::MsgVersion>(
+                                resr, 0) == version);
+                }());
+            }
         }
 
         WHEN("We want to execute multiple operations in a row") {
@@ -188,9 +961,80 @@ SCENARIO("PCSX2 can be interacted with remotely through IPC", "[pine]") {
                 }());
             }
 
-            THEN("We error out when packets are too big") {
+            THEN("Batches can be patched and sent again") {
+
+                // we build a batch once, then patch its writes and resend it,
+                // reading back the values, including after a string reply.
+                REQUIRE_NOTHROW([&]() {
+                    PINE::PCSX2 ipc;
+                    PINE::PCSX2::BatchSlot<u32> slots[16];
+                    ipc.InitializeBatch();
+                    for (u32 i = 0; i < 16; i++)
+                        ipc.Write<u32, true>(0x00347EA4 + i * 4, 0, &slots[i]);
+                    auto writes = ipc.FinalizeBatch();
+
+                    ipc.InitializeBatch();
+                    ipc.Version<true>();
+                    ipc.Read<u32, true>(0x00347EA4);
+                    ipc.Version<true>();
+                    ipc.Read<u32, true>(0x00347EA4 + 15 * 4);
+                    auto reads = ipc.FinalizeBatch();
+
+                    for (u32 frame = 1; frame <= 3; frame++) {
+                        for (u32 i = 0; i < 16; i++)
+                            PINE::PCSX2::Patch(writes, slots[i], frame * i);
+                        ipc.SendCommand(writes);
+                        ipc.SendCommand(reads);
+                        REQUIRE(ipc.GetReply<PINE::PCSX2::MsgRead32>(reads,
+                                                                     1) == 0);
+                        REQUIRE(ipc.GetReply<PINE::PCSX2::MsgRead32>(
+                                    reads, 3) == frame * 15);
+                        REQUIRE(strncmp(ipc.GetReply<PINE::PCSX2::MsgVersion>(
+                                            reads, 2),
+                                        "PCSX2", 5) == 0);
+                    }
+                }());
+            }
+
+            THEN("Batches can be pipelined") {
+
+                // we submit a bunch of batches back to back and collect their
+                // replies afterwards, in and out of order.
+                REQUIRE_NOTHROW([&]() {
+                    PINE::PCSX2 ipc;
+                    std::vector<PINE::PCSX2::BatchCommand> batches;
+                    for (u32 i = 0; i < 8; i++) {
+                        ipc.InitializeBatch();
+                        ipc.Write<u32, true>(0x00347E74 + i * 4, i);
+                        ipc.Version<true>();
+                        ipc.Read<u32, true>(0x00347E74 + i * 4);
+                        batches.push_back(ipc.FinalizeBatch());
+                    }
+                    std::vector<uint64_t> tickets;
+                    for (auto &batch : batches)
+                        tickets.push_back(ipc.Submit(batch));
+
+                    ipc.Complete(tickets[3]);
+                    REQUIRE(ipc.GetReply<PINE::PCSX2::MsgRead32>(batches[3],
+                                                                 2) == 3);
+                    // a regular command in the middle collects the rest
+                    REQUIRE(ipc.Read<u32>(0x00347E74 + 7 * 4) == 7);
+                    for (u32 i = 0; i < 8; i++) {
+                        if (i == 3)
+                            continue;
+                        ipc.Complete(tickets[i]);
+                        REQUIRE(ipc.GetReply<PINE::PCSX2::MsgRead32>(
+                                    batches[i], 2) == i);
+                        REQUIRE(strncmp(ipc.GetReply<PINE::PCSX2::MsgVersion>(
+                                            batches[i], 1),
+                                        "PCSX2", 5) == 0);
+                    }
+                }());
+            }
+
+            THEN("Batches too big for one packet are split") {
                 // write packets too big
-                REQUIRE_THROWS([&]() {
+                REQUIRE_NOTHROW([&]() {
                     PINE::PCSX2 ipc;
                     ipc.InitializeBatch();
                     for (int i = 0; i < 60000; i++) {
@@ -199,13 +1043,30 @@ SCENARIO("PCSX2 can be interacted with remotely through IPC", "[pine]") {
                     ipc.SendCommand(ipc.FinalizeBatch());
                 }());
 
-                // read packets too big
-                REQUIRE_THROWS([&]() {
+                // read packets too big, replies keep their global index
+                REQUIRE_NOTHROW([&]() {
                     PINE::PCSX2 ipc;
                     ipc.InitializeBatch();
                     for (int i = 0; i < 60000; i++) {
                         ipc.Read<u64, true>(0x00347E34);
                     }
+                    ipc.Version<true>();
+                    auto batch = ipc.FinalizeBatch();
+                    REQUIRE(batch.frames > 1);
+                    ipc.SendCommand(batch);
+                    REQUIRE(ipc.GetReply<PINE::PCSX2::MsgRead64>(
+                                batch, 59999) == 5);
+                    REQUIRE(ipc.GetReplyView<PINE::PCSX2::MsgVersion>(
+                                batch, 60000)
+                                .substr(0, 5) == "PCSX2");
+                }());
+            }
+
+            THEN("We error out when a command cannot fit in a packet") {
+                REQUIRE_THROWS([&]() {
+                    PINE::PCSX2 ipc;
+                    ipc.InitializeBatch();
+                    ipc.ReadRange<true>(0x00347E34, MAX_IPC_RETURN_SIZE);
                     ipc.SendCommand(ipc.FinalizeBatch());
                 }());
             }
@@ -7,65 +7,43 @@ closures=[]
 closures_timer=[]
 
 def write8():
-    return "ipc->Write<uint8_t>(0x" + patch[1:8] + ", 0x" + patch[14:16] + ");"
+    return "ipc->Write<uint8_t, true>(0x" + patch[1:8] + ", 0x" + patch[14:16] + ");"
  
 def write16():
-    return "ipc->Write<uint16_t>(0x" + patch[1:8] + ", 0x" + patch[12:16] + ");"
+    return "ipc->Write<uint16_t, true>(0x" + patch[1:8] + ", 0x" + patch[12:16] + ");"
  
 def write32():
-    return "ipc->Write<uint32_t>(0x" + patch[1:8] + ", 0x" + patch[8:16] + ");"
+    return "ipc->Write<uint32_t, true>(0x" + patch[1:8] + ", 0x" + patch[8:16] + ");"
 
 def increment():
+    # the emulator modifies the value in place, in a single round trip and
+    # without racing the game
     # inc 8bit
     if(int(patch[2:3], 16) == 0):
-        return "ipc->Write<uint8_t>(0x" + patch[9:16] + ", ipc->Read<uint8_t>(0x" + patch[9:16] + ") + 0x" + patch[6:8] + ");"
+        return "ipc->Modify<uint8_t, true>(0x" + patch[9:16] + ", PINE::Shared::Add, 0x" + patch[6:8] + ");"
     # dec 8bit
     if(int(patch[2:3], 16) == 1):
-        return "ipc->Write<uint8_t>(0x" + patch[9:16] + ", ipc->Read<uint8_t>(0x" + patch[9:16] + ") - 0x" + patch[6:8] + ");"
+        return "ipc->Modify<uint8_t, true>(0x" + patch[9:16] + ", PINE::Shared::Sub, 0x" + patch[6:8] + ");"
     # inc 16bit
     if(int(patch[2:3], 16) == 2):
-        return "ipc->Write<uint16_t>(0x" + patch[9:16] + ", ipc->Read<uint8_t>(0x" + patch[9:16] + ") + 0x" + patch[4:8] + ");"
+        return "ipc->Modify<uint16_t, true>(0x" + patch[9:16] + ", PINE::Shared::Add, 0x" + patch[4:8] + ");"
     # dec 16bit
     if(int(patch[2:3], 16) == 3):
-        return "ipc->Write<uint16_t>(0x" + patch[9:16] + ", ipc->Read<uint8_t>(0x" + patch[9:16] + ") - 0x" + patch[4:8] + ");"
+        return "ipc->Modify<uint16_t, true>(0x" + patch[9:16] + ", PINE::Shared::Sub, 0x" + patch[4:8] + ");"
 
 def condition():
     global closures
     closures.append(int(patch[2:4], 16))
-    # equal 
-    if(int(patch[8:9], 16) == 0):
-        # 16 bit
-        if(int(patch[1:2], 16) == 0):
-            return "if(ipc->Read<uint16_t>(0x" + patch[9:16] + ") == 0x" + patch[6:8] + ") {"
-        #8 bit
-        else:
-            return "if(ipc->Read<uint8_t>(0x" + patch[9:16] + ") == 0x" + patch[7:8] + ") {"
-    # not equal 
-    if(int(patch[8:9], 16) == 1):
-        # 16 bit
-        if(int(patch[1:2], 16) == 0):
-            return "if(ipc->Read<uint16_t>(0x" + patch[9:16] + ") != 0x" + patch[6:8] + ") {"
-        #8 bit
-        else:
-            return "if(ipc->Read<uint8_t>(0x" + patch[9:16] + ") == 0x" + patch[7:8] + ") {"
-
-    # lesser 
-    if(int(patch[8:9], 16) == 2):
-        # 16 bit
-        if(int(patch[1:2], 16) == 0):
-            return "if(ipc->Read<uint16_t>(0x" + patch[9:16] + ") >= 0x" + patch[6:8] + ") {"
-        #8 bit
-        else:
-            return "if(ipc->Read<uint8_t>(0x" + patch[9:16] + ") >= 0x" + patch[7:8] + ") {"
-
-    # greater 
-    if(int(patch[8:9], 16) == 3):
-        # 16 bit
-        if(int(patch[1:2], 16) == 0):
-            return "if(ipc->Read<uint16_t>(0x" + patch[9:16] + ") <= 0x" + patch[6:8] + ") {"
-        #8 bit
-        else:
-            return "if(ipc->Read<uint8_t>(0x" + patch[9:16] + ") <= 0x" + patch[7:8] + ") {"
+    # the emulator evaluates the condition itself, skipping the block when
+    # it does not hold
+    # equal, not equal, lesser and greater
+    comparison = ["Equal", "NotEqual", "Less", "Greater"][int(patch[8:9], 16)]
+    # 16 bit
+    if(int(patch[1:2], 16) == 0):
+        return "ipc->BeginIf<uint16_t>(0x" + patch[9:16] + ", PINE::Shared::" + comparison + ", 0x" + patch[4:8] + ");"
+    #8 bit
+    else:
+        return "ipc->BeginIf<uint8_t>(0x" + patch[9:16] + ", PINE::Shared::" + comparison + ", 0x" + patch[6:8] + ");"
 
 # this is part of the PR "PNACH Improvements". To let you know how "good" this
 # PR is, this script was made to entirely migrate from it.
@@ -99,9 +77,9 @@ switcher = {
         0xb: timer,
         0xe: condition 
     }
-print("//TODO: fix my indentation\nvoid pnach_thread(PCSX2Ipc *ipc)"
-        + "{\nwhile(true) {\n" 
-        + "\ntry {\nmsleep(16); // every frame at 60fps\n")
+# the whole file is a single batch, sent once per frame
+print("//TODO: fix my indentation\nvoid pnach_thread(PINE::PCSX2 *ipc)"
+        + "{\nipc->InitializeBatch();\n")
 for i in f.readlines():
     i=i.replace("--//", "//--").replace("\n","").replace("\t"," ")
     if "patch=1,EE," in i[:11]:
@@ -113,7 +91,7 @@ for i in f.readlines():
         for y in range(0, len(closures)):
             closures[y]=closures[y]-1
             if(closures[y]==0):
-                eol+=" }"
+                eol+=" ipc->EndIf();"
         for y in range(0, len(closures_timer)):
             closures_timer[y]=closures_timer[y]-1
             if(closures_timer[y]==0):
@@ -122,4 +100,7 @@ for i in f.readlines():
     else:
         if not "gametitle" in i:
             print(i)
-print("}\ncatch(...) {\n}\n//do nothing on failure\n}\n}")
+print("auto batch = ipc->FinalizeBatch();\nwhile(true) {\n"
+        + "try {\nmsleep(16); // every frame at 60fps\n"
+        + "ipc->SendCommand(batch);\n}\ncatch(...) {\n}\n"
+        + "//do nothing on failure\n}\n}")